@@ -0,0 +1,429 @@
+/*
+    bench - fixed set of workloads on a fresh image with the SD cost model.
+    Every workload prints the requests of the library, SD commands,
+    blocks moved and the modeled card time, so the numbers of two builds
+    can be compared directly. Workloads run in order on one mount: the
+    cache is warm after the first one, as on the device.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs.h"
+#include "dirent.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/stat.h"
+
+#include "file_bdev.h"
+#include "mkfat.h"
+#include "sd_cost.h"
+
+#define DEEP_LEVELS 8       // depth of the deep path
+#define DEEP_SIBLINGS 15    // other directories on every level
+#define BIG_FILES 300       // files in the big directory
+#define SEQ_SIZE (1024UL * 1024)
+#define RESOLVE_OPS 100
+#define SEEK_OPS 500
+#define CHURN_OPS 100
+
+static const char deep_path[] = "L1/L2/L3/L4/L5/L6/L7/L8/DEEP.TXT";
+
+static bdev_t disk;         // image file
+static bdev_t sd;           // the image seen through the cost model
+static sd_cost_t cost;
+static uint8_t buf[4096];
+static uint32_t rnd_state = 1;
+
+typedef struct bench_s {
+    const char *name;
+    uint32_t (*run)(void);  // returns number of operations; 0 on error
+} bench_t;
+
+static uint32_t rnd(void) {
+    // the same sequence on every host
+    rnd_state = rnd_state * 1103515245 + 12345;
+    return rnd_state >> 8;
+}
+
+#if FS_STATS
+static uint32_t bench_ticks(void) {
+    // modeled card time in us
+    return cost.time_ns / 1000;
+}
+
+static void print_stats(void) {
+    fs_stats_t st;
+
+    if (fs_stats_get(0, &st))
+        return;
+
+    printf("volume 0: rd_sect %lu, wr_sect %lu, cache hit %lu, miss %lu, "
+           "fat_load %lu, dir_scan %lu, alloc %lu\nlatency, us:",
+           (unsigned long)st.rd_sect, (unsigned long)st.wr_sect,
+           (unsigned long)st.cache_hit, (unsigned long)st.cache_miss,
+           (unsigned long)st.fat_load, (unsigned long)st.dir_scan,
+           (unsigned long)st.alloc);
+    for (uint8_t i = 0; i < FS_STATS_LAT_BUCKETS; i++) {
+        if (st.lat[i])
+            printf(" <%lu:%u", 1UL << i, st.lat[i]);
+    }
+    printf("\n");
+}
+#endif  /* FS_STATS */
+
+/*!
+ * @brief Write file of \p size bytes with \p chunk bytes per call
+ * @return 0 on success
+ */
+static int8_t put_file(const char *path, uint32_t size, uint16_t chunk) {
+    uint16_t n;
+    int8_t fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0)
+        return -1;
+
+    for (uint32_t pos = 0; pos < size; pos += n) {
+        n = (size - pos < chunk) ? size - pos : chunk;
+        for (uint16_t i = 0; i < n; i++)
+            buf[i] = (uint8_t)(pos + i);
+        if (write(fd, buf, n) != n) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    return close(fd);
+}
+
+static uint32_t bench_mount(void) {
+    static spi_dev_t dev;
+    DIR *dir;
+
+    blk_set_dev(&dev, &sd);
+    if (volumes_determine(&dev) < 0)
+        return 0;
+
+    // a volume is there if its root can be opened
+    dir = opendir("/");
+    if (!dir)
+        return 0;
+    closedir(dir);
+
+    return 1;
+}
+
+static uint32_t bench_create(void) {
+    char path[20];
+
+    for (uint16_t i = 0; i < BIG_FILES; i++) {
+        sprintf(path, "BIG/F%04u.TXT", i);
+        if (put_file(path, 32, 32))
+            return 0;
+    }
+    if (put_file(deep_path, 100, 100))
+        return 0;
+    sync();
+
+    return BIG_FILES + 1;
+}
+
+static uint32_t bench_list(void) {
+    struct dirent *ent;
+    uint32_t cnt = 0;
+    DIR *dir;
+
+    dir = opendir("BIG");
+    if (!dir)
+        return 0;
+    while ((ent = readdir(dir)))
+        cnt++;
+    closedir(dir);
+
+    return (cnt >= BIG_FILES) ? cnt : 0;
+}
+
+static uint32_t bench_resolve(void) {
+    struct stat st;
+
+    for (uint16_t i = 0; i < RESOLVE_OPS; i++) {
+        if (stat(deep_path, &st) || (st.st_size != 100))
+            return 0;
+    }
+
+    return RESOLVE_OPS;
+}
+
+static uint32_t bench_lookup(void) {
+    struct stat st;
+    char path[20];
+
+    for (uint16_t i = 0; i < RESOLVE_OPS; i++) {
+        sprintf(path, "BIG/F%04u.TXT", (unsigned)(rnd() % BIG_FILES));
+        if (stat(path, &st))
+            return 0;
+    }
+
+    return RESOLVE_OPS;
+}
+
+static uint32_t bench_seq_write(void) {
+    if (put_file("SEQ.BIN", SEQ_SIZE, sizeof(buf)))
+        return 0;
+    sync();
+
+    return SEQ_SIZE / sizeof(buf);
+}
+
+static uint32_t seq_read(uint16_t chunk) {
+    uint32_t pos = 0;
+    uint32_t ops = 0;
+    int16_t n;
+    int8_t fd;
+
+    fd = open("SEQ.BIN", O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    while ((n = read(fd, buf, chunk)) > 0) {
+        if (buf[0] != (uint8_t)pos)
+            break;
+        pos += n;
+        ops++;
+    }
+    close(fd);
+
+    return (pos == SEQ_SIZE) ? ops : 0;
+}
+
+static uint32_t bench_seq_read(void) {
+    return seq_read(sizeof(buf));
+}
+
+static uint32_t bench_seq_read_small(void) {
+    return seq_read(100);
+}
+
+static uint32_t bench_seek(void) {
+    uint32_t pos;
+    int8_t fd;
+
+    fd = open("SEQ.BIN", O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    for (uint16_t i = 0; i < SEEK_OPS; i++) {
+        pos = rnd() % (SEQ_SIZE - 64);
+        if ((lseek(fd, pos, SEEK_SET) != (int32_t)pos) ||
+            (read(fd, buf, 64) != 64) || (buf[0] != (uint8_t)pos)) {
+            close(fd);
+            return 0;
+        }
+    }
+    close(fd);
+
+    return SEEK_OPS;
+}
+
+static uint32_t bench_churn(void) {
+    char path[16];
+
+    for (uint16_t i = 0; i < CHURN_OPS; i++) {
+        sprintf(path, "TMP%u.LOG", i % 10);
+        if (put_file(path, 200 + (rnd() % 2000), 200) || unlink(path))
+            return 0;
+    }
+    sync();
+
+    return CHURN_OPS;
+}
+
+static const bench_t benches[] = {
+    {"mount", bench_mount},
+    {"create", bench_create},
+    {"list", bench_list},
+    {"resolve", bench_resolve},
+    {"lookup", bench_lookup},
+    {"seq-write", bench_seq_write},
+    {"seq-read", bench_seq_read},
+    {"seq-read-100", bench_seq_read_small},
+    {"seek", bench_seek},
+    {"churn", bench_churn},
+};
+
+/*!
+ * @brief Build the directory tree the workloads expect
+ * @return 0 on success
+ */
+static int8_t make_tree(uint8_t fat_bits, uint8_t spc) {
+    mkfat_t fs;
+    uint32_t parent = 0;
+    uint32_t clst;
+    char name[12];
+
+    if (mkfat(&fs, &disk, fat_bits, spc))
+        return -1;
+
+    if (!mkfat_mkdir(&fs, 0, "BIG"))
+        return -1;
+
+    for (uint8_t lvl = 1; lvl <= DEEP_LEVELS; lvl++) {
+        // the wanted directory is the last one of the level
+        for (uint8_t i = 0; i < DEEP_SIBLINGS; i++) {
+            sprintf(name, "D%u_%u", lvl, i);
+            if (!mkfat_mkdir(&fs, parent, name))
+                return -1;
+        }
+        sprintf(name, "L%u", lvl);
+        clst = mkfat_mkdir(&fs, parent, name);
+        if (!clst)
+            return -1;
+        parent = clst;
+    }
+
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: bench [options] [workload...]\n"
+            "  -o IMAGE  image file (default bench.img, removed after run)\n"
+            "  -k        keep the image\n"
+            "  -F 16|32  FAT type (default 32)\n"
+            "  -s MB     image size (default 512)\n"
+            "  -S N      sectors per cluster (default 8)\n"
+            "  -a N      allocation unit of the card in blocks\n"
+            "  -c US     command latency, us (default 100)\n"
+            "  -b NS     SPI time of a byte, ns (default 1000)\n"
+            "  -w US     write busy time of a block, us (default 250)\n"
+            "  -e US     erase command time, us (default 2000)\n");
+}
+
+int main(int argc, char **argv) {
+    const char *image = "bench.img";
+    uint8_t keep = 0;
+    uint8_t fat_bits = 32;
+    uint32_t size_mb = 512;
+    uint8_t spc = 8;
+    uint32_t au = 0;
+    const char *only[sizeof(benches) / sizeof(benches[0])];
+    uint8_t only_cnt = 0;
+    sd_cost_t total = {0};
+    int ret = 0;
+    uint32_t ops;
+
+    sd_cost_default(&cost);
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if ((opt[0] != '-') && (only_cnt < sizeof(only) / sizeof(only[0]))) {
+            only[only_cnt++] = opt;
+            continue;
+        }
+        if (!strcmp(opt, "-k")) {
+            keep = 1;
+            continue;
+        }
+        if (!val || (strlen(opt) != 2)) {
+            usage();
+            return 2;
+        }
+        i++;
+        switch (opt[1]) {
+            case 'o': image = val; break;
+            case 'F': fat_bits = atoi(val); break;
+            case 's': size_mb = atoi(val); break;
+            case 'S': spc = atoi(val); break;
+            case 'a': au = strtoul(val, NULL, 0); break;
+            case 'c': cost.cmd_ns = atol(val) * 1000; break;
+            case 'b': cost.byte_ns = atol(val); break;
+            case 'w': cost.busy_ns = atol(val) * 1000; break;
+            case 'e': cost.erase_ns = atol(val) * 1000; break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+
+    if (((fat_bits != 16) && (fat_bits != 32)) ||
+        file_bdev_create(&disk, image, size_mb * 2048)) {
+        fprintf(stderr, "can't create %s\n", image);
+        return 1;
+    }
+    disk.bd_au_size = au;
+    if (make_tree(fat_bits, spc)) {
+        fprintf(stderr, "can't format %s: FAT%u, %lu MB, %u sectors/cluster\n",
+                image, fat_bits, (unsigned long)size_mb, spc);
+        ret = 1;
+        goto out;
+    }
+    sd_cost_init(&cost, &sd, &disk);
+#if FS_STATS
+    fs_stats_clock(bench_ticks);
+#endif  /* FS_STATS */
+
+    printf("FAT%u, %lu MB, %u sectors/cluster; cmd %lu us, byte %lu ns, "
+           "busy %lu us, erase %lu us\n",
+           fat_bits, (unsigned long)size_mb, spc,
+           (unsigned long)cost.cmd_ns / 1000, (unsigned long)cost.byte_ns,
+           (unsigned long)cost.busy_ns / 1000,
+           (unsigned long)cost.erase_ns / 1000);
+    printf("%-13s %6s %7s %7s %7s %7s %5s %10s %10s %9s\n",
+           "workload", "ops", "reqs", "cmds", "rd_blk", "wr_blk", "disc",
+           "bytes", "time_ms", "cmds/op");
+
+    for (uint8_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        uint8_t run = !only_cnt || !b;   // mount always runs
+
+        for (uint8_t i = 0; i < only_cnt; i++)
+            run |= !strcmp(only[i], benches[b].name);
+        if (!run)
+            continue;
+
+        sd_cost_reset(&cost);
+        ops = benches[b].run();
+        if (!ops) {
+            printf("%-13s failed\n", benches[b].name);
+            ret = 1;
+            if (!b)
+                break;
+            continue;
+        }
+
+        printf("%-13s %6lu %7lu %7lu %7lu %7lu %5lu %10llu %10.3f %9.2f\n",
+               benches[b].name, (unsigned long)ops,
+               (unsigned long)cost.reqs, (unsigned long)cost.cmds,
+               (unsigned long)cost.rd_blocks, (unsigned long)cost.wr_blocks,
+               (unsigned long)cost.discards, (unsigned long long)cost.bytes,
+               cost.time_ns / 1e6, (double)cost.cmds / ops);
+
+        total.reqs += cost.reqs;
+        total.cmds += cost.cmds;
+        total.rd_blocks += cost.rd_blocks;
+        total.wr_blocks += cost.wr_blocks;
+        total.discards += cost.discards;
+        total.bytes += cost.bytes;
+        total.time_ns += cost.time_ns;
+    }
+
+    printf("%-13s %6s %7lu %7lu %7lu %7lu %5lu %10llu %10.3f\n", "total", "",
+           (unsigned long)total.reqs, (unsigned long)total.cmds,
+           (unsigned long)total.rd_blocks, (unsigned long)total.wr_blocks,
+           (unsigned long)total.discards, (unsigned long long)total.bytes,
+           total.time_ns / 1e6);
+#if FS_STATS
+    print_stats();
+#endif  /* FS_STATS */
+
+out:
+    file_bdev_close(&disk);
+    if (!keep)
+        remove(image);
+
+    return ret;
+}
@@ -0,0 +1,144 @@
+/*
+    Block device backed by a disk image file.
+    The library defines open(), read(), close() etc. itself, so the image
+    is reached through stdio and pread()/pwrite() only.
+*/
+
+#define _GNU_SOURCE
+
+#include <avr/pgmspace.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block_dev.h"
+#include "file_bdev.h"
+
+static int file_fd(bdev_t *bdev) {
+    return fileno((FILE *)blk_get_priv(bdev));
+}
+
+/*!
+ * @brief Transfer blocks from/to the image
+ * @param req Request
+ * @return 0 on success
+ */
+static int8_t file_request(req_t *req) {
+    bdev_t *bdev = req->bdev;
+    uint16_t cnt = req->blk_cnt ? req->blk_cnt : 1;
+    off_t pos = (off_t)req->block * bdev->bd_blk_size;
+    size_t len = (size_t)cnt * bdev->bd_blk_size;
+
+    if ((req->block >= bdev->bd_blk_num) ||
+        (cnt > bdev->bd_blk_num - req->block))
+        // out of the device
+        return -1;
+
+    if (req->cmd_flags == REQ_WRITE)
+        return (pwrite(file_fd(bdev), req->buf, len, pos) ==
+                (ssize_t)len) ? 0 : -1;
+
+    if (req->count) {
+        // partial read
+        pos += req->offset;
+        len = req->count;
+    }
+
+    return (pread(file_fd(bdev), req->buf, len, pos) == (ssize_t)len) ?
+           0 : -1;
+}
+
+/*!
+ * @brief Discard blocks: punch a hole in the image.
+ *        If the host file system can't do it, the content is kept,
+ *        which is valid too.
+ * @param bdev Block device
+ * @param block First block
+ * @param cnt Number of blocks
+ * @return 0 on success
+ */
+static int8_t file_discard(bdev_t *bdev, uint32_t block, uint32_t cnt) {
+    if ((block >= bdev->bd_blk_num) || (cnt > bdev->bd_blk_num - block))
+        // out of the device
+        return -1;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    fallocate(file_fd(bdev), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              (off_t)block * bdev->bd_blk_size,
+              (off_t)cnt * bdev->bd_blk_size);
+#endif  /* FALLOC_FL_PUNCH_HOLE */
+
+    return 0;
+}
+
+static const struct blk_dev_ops_s file_ops PROGMEM = {
+    .request = file_request,
+    .request_mb = file_request,
+    .discard = file_discard,
+};
+
+/*!
+ * @brief Open disk image as a block device of 512 byte blocks.
+ *        \a bd_au_size may be set by the caller after that.
+ * @param bdev Block device to fill
+ * @param path Image file
+ * @return 0 on success
+ */
+int8_t file_bdev_open(bdev_t *bdev, const char *path) {
+    struct stat st;
+    FILE *img;
+
+    img = fopen(path, "r+b");
+    if (!img)
+        return -1;
+
+    if (fstat(fileno(img), &st)) {
+        fclose(img);
+        return -1;
+    }
+
+    bdev->bd_blk_size = 512;
+    bdev->bd_blk_num = st.st_size / 512;
+    bdev->bd_au_size = 0;
+    bdev->bd_flags = BD_PART_READ;
+    bdev->blk_ops = &file_ops;
+    blk_set_priv(bdev, img);
+
+    return 0;
+}
+
+/*!
+ * @brief Create empty (sparse) image and open it
+ * @param bdev Block device to fill
+ * @param path Image file; existing file is replaced
+ * @param blk_num Number of 512 byte blocks
+ * @return 0 on success
+ */
+int8_t file_bdev_create(bdev_t *bdev, const char *path, uint32_t blk_num) {
+    FILE *img;
+    int ret;
+
+    img = fopen(path, "wb");
+    if (!img)
+        return -1;
+
+    ret = ftruncate(fileno(img), (off_t)blk_num * 512);
+    fclose(img);
+
+    return ret ? -1 : file_bdev_open(bdev, path);
+}
+
+/*!
+ * @brief Close the image
+ * @param bdev Block device
+ */
+void file_bdev_close(bdev_t *bdev) {
+    FILE *img = blk_get_priv(bdev);
+
+    if (img)
+        fclose(img);
+    blk_set_priv(bdev, NULL);
+}
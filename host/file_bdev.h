@@ -0,0 +1,16 @@
+/*
+    file_bdev.h - block device backed by a disk image file (host build)
+*/
+
+#ifndef FILE_BDEV_H
+#define FILE_BDEV_H
+
+#include <stdint.h>
+
+#include "block_dev.h"
+
+int8_t file_bdev_open(bdev_t *bdev, const char *path);
+int8_t file_bdev_create(bdev_t *bdev, const char *path, uint32_t blk_num);
+void file_bdev_close(bdev_t *bdev);
+
+#endif  /* !FILE_BDEV_H */
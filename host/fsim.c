@@ -0,0 +1,221 @@
+/*
+    fsim - run the library on a disk image.
+    The image must have an MBR partition table, e.g.:
+        truncate -s 64M disk.img
+        echo 'start=2048, type=0c' | sfdisk disk.img
+        mkfs.fat -F 32 --offset 2048 disk.img
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blk_trace.h"
+#include "fs.h"
+#include "fat.h"
+#include "dirent.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/stat.h"
+
+#include "file_bdev.h"
+
+static uint8_t buf[4096];
+
+static void trace_put(const uint8_t *data, uint8_t len, void *arg) {
+    fwrite(data, 1, len, arg);
+}
+
+#if FS_FAT_MSTATE
+/*!
+ * @brief Mount state slot: file "<FSIM_STATE>.<first sector of volume>"
+ */
+static FILE *state_file(const fs_volume_t *vol, const char *mode,
+                        void *arg) {
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s.%lu", (const char *)arg,
+             (unsigned long)vol->start_sector);
+    return fopen(path, mode);
+}
+
+static int8_t state_load(const fs_volume_t *vol, void *buf, uint8_t size,
+                         void *arg) {
+    FILE *f = state_file(vol, "rb", arg);
+    size_t n;
+
+    if (!f)
+        return -1;
+    n = fread(buf, 1, size, f);
+    fclose(f);
+
+    return (n == size) ? 0 : -1;
+}
+
+static int8_t state_store(const fs_volume_t *vol, const void *buf,
+                          uint8_t size, void *arg) {
+    FILE *f = state_file(vol, "wb", arg);
+    size_t n;
+
+    if (!f)
+        return -1;
+    n = fwrite(buf, 1, size, f);
+
+    return (fclose(f) || (n != size)) ? -1 : 0;
+}
+#endif  /* FS_FAT_MSTATE */
+
+static int cmd_ls(const char *path) {
+    struct dirent *ent;
+    DIR *dir;
+
+    dir = opendir(path);
+    if (!dir)
+        return -1;
+
+    while ((ent = readdir(dir)))
+        printf("%s%s\n", ent->d_name, (ent->d_type == DT_DIR) ? "/" : "");
+
+    closedir(dir);
+    return 0;
+}
+
+static int cmd_cat(const char *path) {
+    int16_t n;
+    int8_t fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        fwrite(buf, 1, n, stdout);
+
+    close(fd);
+    return (n < 0) ? -1 : 0;
+}
+
+static int cmd_put(const char *src, const char *path) {
+    FILE *in;
+    size_t n;
+    int8_t fd;
+    int ret = 0;
+
+    in = fopen(src, "rb");
+    if (!in)
+        return -1;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        fclose(in);
+        return -1;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (write(fd, buf, n) != (int16_t)n) {
+            ret = -1;
+            break;
+        }
+    }
+
+    if (close(fd))
+        ret = -1;
+    fclose(in);
+    return ret;
+}
+
+static int cmd_stat(const char *path) {
+    struct stat st;
+
+    if (stat(path, &st))
+        return -1;
+
+    printf("%s: %s, %ld bytes, mtime %lld\n", path,
+           S_ISDIR(st.st_mode) ? "directory" : "file",
+           (long)st.st_size, (long long)st.st_mtime);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: fsim IMAGE ls [PATH]\n"
+            "       fsim IMAGE cat PATH\n"
+            "       fsim IMAGE put FILE PATH\n"
+            "       fsim IMAGE rm PATH\n"
+            "       fsim IMAGE stat PATH\n"
+            "env FSIM_AU: allocation unit of the device in blocks\n"
+            "    FSIM_TRACE: file to record requests to the device\n"
+            "    FSIM_STATE: file prefix to keep mount state in "
+            "(FS_FAT_MSTATE build)\n");
+}
+
+int main(int argc, char **argv) {
+    static bdev_t bdev;
+    static bdev_t traced;
+    static blk_trace_t trace;
+    static spi_dev_t dev;
+    const char *au = getenv("FSIM_AU");
+    const char *trace_path = getenv("FSIM_TRACE");
+    FILE *trace_out = NULL;
+    const char *cmd;
+    int ret;
+
+    if (argc < 3) {
+        usage();
+        return 2;
+    }
+
+    if (file_bdev_open(&bdev, argv[1])) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (au)
+        bdev.bd_au_size = strtoul(au, NULL, 0);
+
+    if (trace_path) {
+        trace_out = fopen(trace_path, "wb");
+        if (!trace_out) {
+            perror(trace_path);
+            return 1;
+        }
+        blk_trace_init(&trace, &traced, &bdev, trace_put, trace_out,
+                       BLK_TRACE_HASH);
+        blk_set_dev(&dev, &traced);
+    } else {
+        blk_set_dev(&dev, &bdev);
+    }
+#if FS_FAT_MSTATE
+    if (getenv("FSIM_STATE"))
+        fat_mstate_set_slot(state_load, state_store, getenv("FSIM_STATE"));
+#endif  /* FS_FAT_MSTATE */
+    if (volumes_determine(&dev) < 0) {
+        fprintf(stderr, "%s: can't read partitions\n", argv[1]);
+        return 1;
+    }
+
+    cmd = argv[2];
+    if (!strcmp(cmd, "ls"))
+        ret = cmd_ls((argc > 3) ? argv[3] : "/");
+    else if (!strcmp(cmd, "cat") && (argc > 3))
+        ret = cmd_cat(argv[3]);
+    else if (!strcmp(cmd, "put") && (argc > 4))
+        ret = cmd_put(argv[3], argv[4]);
+    else if (!strcmp(cmd, "rm") && (argc > 3))
+        ret = unlink(argv[3]);
+    else if (!strcmp(cmd, "stat") && (argc > 3))
+        ret = cmd_stat(argv[3]);
+    else {
+        usage();
+        return 2;
+    }
+
+    sync();
+    file_bdev_close(&bdev);
+    if (trace_out)
+        fclose(trace_out);
+
+    if (ret)
+        fprintf(stderr, "%s: failed\n", cmd);
+    return ret ? 1 : 0;
+}
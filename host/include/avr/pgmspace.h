@@ -0,0 +1,28 @@
+/*
+    avr/pgmspace.h - host stand-in: program memory is ordinary memory
+*/
+
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+#define memcmp_P memcmp
+#define memcpy_P memcpy
+#define strchr_P strchr
+#define strlen_P strlen
+// diagnostics of the library don't mix with the output of the program
+#define printf_P(...) fprintf(stderr, __VA_ARGS__)
+#define sprintf_P sprintf
+
+#endif  /* !HOST_AVR_PGMSPACE_H */
@@ -0,0 +1,21 @@
+/*
+    spi.h - host stand-in for the SPI device of spi-avr.
+    Only the private pointer is used by the library: it holds bdev_t.
+*/
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+typedef struct spi_dev_s {
+    void *priv;     // private data
+} spi_dev_t;
+
+static inline void spi_set_priv(spi_dev_t *dev, void *priv) {
+    dev->priv = priv;
+}
+
+static inline void *spi_get_priv(spi_dev_t *dev) {
+    return dev->priv;
+}
+
+#endif  /* !HOST_SPI_H */
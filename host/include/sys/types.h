@@ -0,0 +1,15 @@
+/*
+    sys/types.h - host wrapper.
+    The library's sys/stat.h defines mode_t and nlink_t unless they are
+    macros; the host types are kept instead.
+*/
+
+#ifndef HOST_SYS_TYPES_H
+#define HOST_SYS_TYPES_H
+
+#include_next <sys/types.h>
+
+#define mode_t mode_t
+#define nlink_t nlink_t
+
+#endif  /* !HOST_SYS_TYPES_H */
@@ -0,0 +1,301 @@
+/*
+    Minimal FAT16/FAT32 formatter: one MBR partition over the whole device
+    and plain 8.3 directories. It writes to the device directly, so it is
+    used before the volume is mounted.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "block_dev.h"
+#include "fat.h"
+#include "mkfat.h"
+
+#define MKFAT_PART_START 2048   // first sector of the partition
+#define MKFAT_NUM_FATS 2
+#define MKFAT_ROOT_ENTS 512     // FAT16 root directory entries
+#define MKFAT_VOL_ID 0x46534156 // serial number of the volume
+
+static uint8_t blk[512];
+
+static int8_t mkfat_io(bdev_t *bdev, uint32_t block, uint8_t cmd) {
+    req_t req = {
+        .bdev = bdev,
+        .cmd_flags = cmd,
+        .block = block,
+        .blk_cnt = 1,
+        .buf = blk,
+    };
+
+    return blk_request(&req);
+}
+
+/*!
+ * @brief Fill sectors with zeros
+ * @param bdev Block device
+ * @param block First sector
+ * @param cnt Number of sectors
+ * @return 0 on success
+ */
+static int8_t mkfat_zero(bdev_t *bdev, uint32_t block, uint32_t cnt) {
+    memset(blk, 0, sizeof(blk));
+    while (cnt--) {
+        if (mkfat_io(bdev, block++, REQ_WRITE))
+            return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Set FAT entry in every copy
+ * @param fs Formatted volume
+ * @param clst Cluster
+ * @param val Value
+ * @return 0 on success
+ */
+static int8_t mkfat_set(mkfat_t *fs, uint32_t clst, uint32_t val) {
+    uint8_t shift = (fs->fat_bits == 32) ? 7 : 8;
+    uint16_t idx = clst & ((1U << shift) - 1);
+
+    for (uint8_t i = 0; i < MKFAT_NUM_FATS; i++) {
+        uint32_t sect = fs->fat_sector + (i * fs->sec_per_fat) +
+                        (clst >> shift);
+
+        if (mkfat_io(fs->bdev, sect, REQ_READ))
+            return -1;
+        if (fs->fat_bits == 32)
+            ((uint32_t *)blk)[idx] = val;
+        else
+            ((uint16_t *)blk)[idx] = val;
+        if (mkfat_io(fs->bdev, sect, REQ_WRITE))
+            return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Write free clusters number and next free cluster to FSInfo
+ * @param fs Formatted volume
+ * @return 0 on success
+ */
+static int8_t mkfat_fsinfo(mkfat_t *fs) {
+    fs_info_t *fsi = (fs_info_t *)blk;
+
+    if (fs->fat_bits != 32)
+        return 0;
+
+    memset(blk, 0, sizeof(blk));
+    fsi->FSI_LeadSig = FSI_LEAD_SIG;
+    fsi->FSI_StrucSig = FSI_STRUC_SIG;
+    fsi->FSI_Free_Count = fs->clusters - (fs->next_free - 2);
+    fsi->FSI_Nxt_Free = fs->next_free;
+    fsi->FSI_TrailSig = FSI_TRAIL_SIG;
+
+    return mkfat_io(fs->bdev, fs->fsi_sector, REQ_WRITE);
+}
+
+static void mkfat_ent(dir_t *ent, const char *name, uint8_t attr,
+                      uint32_t clst) {
+    const char *ext = strchr(name, '.');
+    uint8_t len = ext ? ext - name : strlen(name);
+
+    memset(ent, 0, sizeof(*ent));
+    memset(ent->DIR_Name, ' ', sizeof(ent->DIR_Name));
+    memcpy(ent->DIR_Name, name, (len > 8) ? 8 : len);
+    if (ext && (ext != name))
+        memcpy(ent->DIR_Name + 8, ext + 1,
+               (strlen(ext + 1) > 3) ? 3 : strlen(ext + 1));
+    else if (ext)
+        // "." and ".."
+        memcpy(ent->DIR_Name, name, strlen(name));
+    ent->DIR_Attr = attr;
+    ent->DIR_WrtDate = ent->DIR_CrtDate = (46 << 9) | (1 << 5) | 1;
+    ent->DIR_FstClusHI = clst >> 16;
+    ent->DIR_FstClusLO = (uint16_t)clst;
+}
+
+/*!
+ * @brief Create FAT file system over the whole device
+ * @param fs Volume data to fill
+ * @param bdev Block device; the data area is aligned to its \a bd_au_size
+ * @param fat_bits 16 or 32
+ * @param spc Sectors per cluster
+ * @return 0 on success; -1 if the size doesn't fit the FAT type
+ */
+int8_t mkfat(mkfat_t *fs, bdev_t *bdev, uint8_t fat_bits, uint8_t spc) {
+    uint32_t tot = bdev->bd_blk_num - MKFAT_PART_START;
+    uint16_t rsvd = (fat_bits == 32) ? 32 : 4;
+    uint16_t root_secs = (fat_bits == 32) ? 0 : MKFAT_ROOT_ENTS * 32 / 512;
+    uint8_t ent_size = fat_bits / 8;
+    bpb_t *bpb = (bpb_t *)blk;
+    uint32_t need;
+
+    if ((bdev->bd_blk_num <= MKFAT_PART_START) || !spc || (spc & (spc - 1)))
+        return -1;
+
+    fs->bdev = bdev;
+    fs->fat_bits = fat_bits;
+    fs->spc = spc;
+    fs->sec_per_fat = 1;
+    for (;;) {
+        fs->clusters = (tot - rsvd - root_secs -
+                        MKFAT_NUM_FATS * fs->sec_per_fat) / spc;
+        need = ((fs->clusters + 2) * ent_size + 511) / 512;
+        if (need <= fs->sec_per_fat)
+            break;
+        fs->sec_per_fat = need;
+    }
+
+    if (bdev->bd_au_size) {
+        // pad the reserved area so the data area starts on an allocation
+        // unit of the card, as SD Formatter does; fewer clusters still
+        // fit the FAT
+        need = MKFAT_PART_START + rsvd + MKFAT_NUM_FATS * fs->sec_per_fat +
+               root_secs;
+        rsvd += (bdev->bd_au_size - need % bdev->bd_au_size) %
+                bdev->bd_au_size;
+        fs->clusters = (tot - rsvd - root_secs -
+                        MKFAT_NUM_FATS * fs->sec_per_fat) / spc;
+    }
+
+    if ((fat_bits == 16) ? ((fs->clusters < 4085) || (fs->clusters >= 65525))
+                         : (fs->clusters < 65525))
+        // size doesn't fit the type
+        return -1;
+
+    fs->fat_sector = MKFAT_PART_START + rsvd;
+    fs->root_sector = fs->fat_sector + MKFAT_NUM_FATS * fs->sec_per_fat;
+    fs->data_sector = fs->root_sector + root_secs;
+    fs->fsi_sector = MKFAT_PART_START + 1;
+    fs->next_free = 2;
+
+    // MBR
+    memset(blk, 0, sizeof(blk));
+    blk[446] = 0x00;
+    blk[446 + 4] = (fat_bits == 32) ? 0x0C : 0x06;
+    memcpy(blk + 446 + 8, &(uint32_t){MKFAT_PART_START}, 4);
+    memcpy(blk + 446 + 12, &tot, 4);
+    blk[510] = 0x55;
+    blk[511] = 0xAA;
+    if (mkfat_io(bdev, 0, REQ_WRITE))
+        return -1;
+
+    // FATs and root directory
+    if (mkfat_zero(bdev, MKFAT_PART_START,
+                   fs->data_sector - MKFAT_PART_START +
+                   ((fat_bits == 32) ? spc : 0)))
+        return -1;
+
+    memset(blk, 0, sizeof(blk));
+    memcpy(bpb->BS_jmpBoot, "\xEB\x58\x90", 3);
+    memcpy(bpb->BS_OEMName, "FS-AVR  ", 8);
+    bpb->BPB_BytsPerSec = 512;
+    bpb->BPB_SecPerClus = spc;
+    bpb->BPB_RsvdSecCnt = rsvd;
+    bpb->BPB_NumFATs = MKFAT_NUM_FATS;
+    bpb->BPB_RootEntCnt = (fat_bits == 32) ? 0 : MKFAT_ROOT_ENTS;
+    bpb->BPB_Media = 0xF8;
+    bpb->BPB_SecPerTrk = 63;
+    bpb->BPB_NumHeads = 255;
+    bpb->BPB_HiddSec = MKFAT_PART_START;
+    if (tot < 0x10000)
+        bpb->BPB_TotSec16 = tot;
+    else
+        bpb->BPB_TotSec32 = tot;
+    if (fat_bits == 32) {
+        bpb->fat32_ext.BPB_FATSz32 = fs->sec_per_fat;
+        bpb->fat32_ext.BPB_RootClus = 2;
+        bpb->fat32_ext.BPB_FSInfo = 1;
+        bpb->fat32_ext.BPB_BkBootSec = 6;
+        bpb->fat32_ext.BS_DrvNum = 0x80;
+        bpb->fat32_ext.BS_BootSig = 0x29;
+        bpb->fat32_ext.BS_VolID = MKFAT_VOL_ID;
+        memcpy(bpb->fat32_ext.BS_VolLab, "NO NAME    ", 11);
+        memcpy(bpb->fat32_ext.BS_FilSysType, "FAT32   ", 8);
+    } else {
+        bpb->BPB_FATSz16 = fs->sec_per_fat;
+        bpb->fat12_16_ext.BS_DrvNum = 0x80;
+        bpb->fat12_16_ext.BS_BootSig = 0x29;
+        bpb->fat12_16_ext.BS_VolID = MKFAT_VOL_ID;
+        memcpy(bpb->fat12_16_ext.BS_VolLab, "NO NAME    ", 11);
+        memcpy(bpb->fat12_16_ext.BS_FilSysType, "FAT16   ", 8);
+    }
+    bpb->BS_signature = 0xAA55;
+    if (mkfat_io(bdev, MKFAT_PART_START, REQ_WRITE) ||
+        ((fat_bits == 32) && mkfat_io(bdev, MKFAT_PART_START + 6, REQ_WRITE)))
+        return -1;
+
+    // reserved entries; FAT32 root takes cluster #2
+    if (mkfat_set(fs, 0, (fat_bits == 32) ? 0x0FFFFFF8 : 0xFFF8) ||
+        mkfat_set(fs, 1, (fat_bits == 32) ? 0x0FFFFFFF : 0xFFFF))
+        return -1;
+    if (fat_bits == 32) {
+        if (mkfat_set(fs, 2, 0x0FFFFFFF))
+            return -1;
+        fs->next_free = 3;
+    }
+
+    return mkfat_fsinfo(fs);
+}
+
+/*!
+ * @brief Create directory of one cluster.
+ *        Parent must have a free entry in its first cluster (or in
+ *        the FAT16 root).
+ * @param fs Formatted volume
+ * @param parent First cluster of the parent; 0 - root
+ * @param name 8.3 name in upper case
+ * @return First cluster of the new directory; 0 on error
+ */
+uint32_t mkfat_mkdir(mkfat_t *fs, uint32_t parent, const char *name) {
+    uint32_t clst = fs->next_free;
+    uint32_t sect;
+    uint32_t cnt;
+    dir_t *ent;
+
+    if (clst >= fs->clusters + 2)
+        return 0;
+
+    // new directory
+    if (mkfat_zero(fs->bdev, fs->data_sector + (clst - 2) * fs->spc,
+                   fs->spc))
+        return 0;
+    ent = (dir_t *)blk;
+    mkfat_ent(&ent[0], ".", ATTR_DIRECTORY, clst);
+    mkfat_ent(&ent[1], "..", ATTR_DIRECTORY, parent);
+    if (mkfat_io(fs->bdev, fs->data_sector + (clst - 2) * fs->spc, REQ_WRITE))
+        return 0;
+
+    if (mkfat_set(fs, clst, (fs->fat_bits == 32) ? 0x0FFFFFFF : 0xFFFF))
+        return 0;
+    fs->next_free++;
+    if (mkfat_fsinfo(fs))
+        return 0;
+
+    // entry in the parent
+    if (!parent && (fs->fat_bits == 32))
+        parent = 2;
+    if (parent) {
+        sect = fs->data_sector + (parent - 2) * fs->spc;
+        cnt = fs->spc;
+    } else {
+        sect = fs->root_sector;
+        cnt = fs->data_sector - fs->root_sector;
+    }
+
+    for (; cnt; cnt--, sect++) {
+        if (mkfat_io(fs->bdev, sect, REQ_READ))
+            return 0;
+        for (uint8_t i = 0; i < FAT_DIR_PER_SECT; i++) {
+            if (ent[i].DIR_Name[0])
+                continue;
+            mkfat_ent(&ent[i], name, ATTR_DIRECTORY, clst);
+            return mkfat_io(fs->bdev, sect, REQ_WRITE) ? 0 : clst;
+        }
+    }
+
+    // parent is full
+    return 0;
+}
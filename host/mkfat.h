@@ -0,0 +1,28 @@
+/*
+    mkfat.h - FAT formatter for the host tools
+*/
+
+#ifndef MKFAT_H
+#define MKFAT_H
+
+#include <stdint.h>
+
+#include "block_dev.h"
+
+typedef struct mkfat_s {
+    bdev_t *bdev;
+    uint8_t fat_bits;       // 16 or 32
+    uint8_t spc;            // sectors per cluster
+    uint32_t fat_sector;    // first sector of the first FAT (LBA)
+    uint32_t sec_per_fat;   // sectors per FAT
+    uint32_t root_sector;   // first sector of FAT16 root (LBA)
+    uint32_t data_sector;   // first sector of cluster #2 (LBA)
+    uint32_t clusters;      // number of data clusters
+    uint32_t next_free;     // next cluster to allocate
+    uint32_t fsi_sector;    // FSInfo sector (LBA); FAT32 only
+} mkfat_t;
+
+int8_t mkfat(mkfat_t *fs, bdev_t *bdev, uint8_t fat_bits, uint8_t spc);
+uint32_t mkfat_mkdir(mkfat_t *fs, uint32_t parent, const char *name);
+
+#endif  /* !MKFAT_H */
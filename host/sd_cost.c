@@ -0,0 +1,106 @@
+/*
+    Block device wrapper that counts the I/O of the library and charges
+    SD card time for it. A multi-block transfer is a command plus a stop
+    command; every block costs its data, token and CRC on the bus, and
+    a written block costs the busy time of the card. Partial reads still
+    clock the whole block out of the card.
+*/
+
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "block_dev.h"
+#include "sd_cost.h"
+
+#define SD_BLK_OVERHEAD 3   // data token and CRC16 of a block
+
+/* defaults: 8 MHz SPI clock */
+#define SD_CMD_NS 100000
+#define SD_BYTE_NS 1000
+#define SD_BUSY_NS 250000
+#define SD_ERASE_NS 2000000
+
+static int8_t sd_cost_request(req_t *req) {
+    sd_cost_t *cost = blk_get_priv(req->bdev);
+    uint16_t blk_size = req->bdev->bd_blk_size;
+    uint16_t cnt = req->blk_cnt ? req->blk_cnt : 1;
+    req_t lower = *req;
+
+    cost->reqs++;
+    cost->cmds += (cnt > 1) ? 2 : 1;
+    cost->time_ns += (uint64_t)cost->cmd_ns * ((cnt > 1) ? 2 : 1) +
+                     (uint64_t)cost->byte_ns * cnt *
+                     (blk_size + SD_BLK_OVERHEAD);
+
+    if (req->cmd_flags == REQ_WRITE) {
+        cost->wr_blocks += cnt;
+        cost->bytes += (uint32_t)cnt * blk_size;
+        cost->time_ns += (uint64_t)cost->busy_ns * cnt;
+    } else {
+        cost->rd_blocks += cnt;
+        cost->bytes += req->count ? req->count : (uint32_t)cnt * blk_size;
+    }
+
+    lower.bdev = cost->lower;
+
+    return blk_request(&lower);
+}
+
+static int8_t sd_cost_discard(bdev_t *bdev, uint32_t block, uint32_t cnt) {
+    sd_cost_t *cost = blk_get_priv(bdev);
+
+    // CMD32, CMD33, CMD38
+    cost->discards++;
+    cost->cmds += 3;
+    cost->time_ns += (uint64_t)cost->cmd_ns * 3 + cost->erase_ns;
+
+    return blk_discard(cost->lower, block, cnt);
+}
+
+static const struct blk_dev_ops_s sd_cost_ops PROGMEM = {
+    .request = sd_cost_request,
+    .request_mb = sd_cost_request,
+    .discard = sd_cost_discard,
+};
+
+/*!
+ * @brief Set the default model
+ * @param cost Counters and model
+ */
+void sd_cost_default(sd_cost_t *cost) {
+    cost->cmd_ns = SD_CMD_NS;
+    cost->byte_ns = SD_BYTE_NS;
+    cost->busy_ns = SD_BUSY_NS;
+    cost->erase_ns = SD_ERASE_NS;
+}
+
+/*!
+ * @brief Set up the wrapper and zero counters; the model is kept
+ * @param cost Counters and model
+ * @param bdev Device to fill; its geometry is taken from \p lower
+ * @param lower Device doing the transfers
+ */
+void sd_cost_init(sd_cost_t *cost, bdev_t *bdev, bdev_t *lower) {
+    cost->lower = lower;
+    sd_cost_reset(cost);
+
+    *bdev = *lower;
+    bdev->blk_ops = &sd_cost_ops;
+    blk_set_priv(bdev, cost);
+}
+
+/*!
+ * @brief Zero the counters
+ * @param cost Counters and model
+ */
+void sd_cost_reset(sd_cost_t *cost) {
+    cost->cmds = 0;
+    cost->reqs = 0;
+    cost->rd_blocks = 0;
+    cost->wr_blocks = 0;
+    cost->discards = 0;
+    cost->bytes = 0;
+    cost->time_ns = 0;
+}
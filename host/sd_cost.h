@@ -0,0 +1,35 @@
+/*
+    sd_cost.h - block device wrapper with I/O counters and SD cost model
+*/
+
+#ifndef SD_COST_H
+#define SD_COST_H
+
+#include <stdint.h>
+
+#include "block_dev.h"
+
+typedef struct sd_cost_s {
+    bdev_t *lower;          // device doing the transfers
+
+    /* model */
+    uint32_t cmd_ns;        // command with response and data token wait
+    uint32_t byte_ns;       // SPI time of a byte
+    uint32_t busy_ns;       // programming time of a written block
+    uint32_t erase_ns;      // erase (discard) command
+
+    /* counters */
+    uint32_t cmds;          // SD commands (CMD17/18/24/25/12, erase)
+    uint32_t reqs;          // requests of the library
+    uint32_t rd_blocks;     // blocks read
+    uint32_t wr_blocks;     // blocks written
+    uint32_t discards;      // discard requests
+    uint64_t bytes;         // bytes passed to/from the library
+    uint64_t time_ns;       // modeled time
+} sd_cost_t;
+
+void sd_cost_default(sd_cost_t *cost);
+void sd_cost_init(sd_cost_t *cost, bdev_t *bdev, bdev_t *lower);
+void sd_cost_reset(sd_cost_t *cost);
+
+#endif  /* !SD_COST_H */
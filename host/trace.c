@@ -0,0 +1,415 @@
+/*
+    trace - replay a block trace (blk_trace.h) and report access patterns.
+    Requests go through the SD cost model to an image (-i) or to a null
+    device; with an image, data of read records is checked against their
+    hashes. Written data is not in the trace, so writes replay zeros.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_dev.h"
+#include "blk_trace.h"
+
+#include "file_bdev.h"
+#include "sd_cost.h"
+
+#define HIST_BUCKETS 33
+#define HOT_BLOCKS 10
+
+typedef struct blk_cnt_s {
+    uint32_t block;
+    uint32_t reads;
+    uint32_t writes;
+} blk_cnt_t;
+
+/* block counters: open addressing table, key 0 is stored aside */
+static blk_cnt_t *tab;
+static uint32_t tab_size;
+static uint32_t tab_used;
+static blk_cnt_t blk_zero;
+
+static uint32_t rec_num[3];
+static uint64_t rec_blocks[3];
+static uint32_t errors;
+static uint32_t partial;
+static uint32_t hashed;
+static uint32_t mismatch;
+static uint32_t seq_reqs;
+static uint32_t runs;
+static uint64_t run_blocks;
+static uint64_t run_max;
+static uint32_t jump_hist[HIST_BUCKETS];
+
+static uint8_t *buf;
+static uint32_t buf_size;
+
+static uint8_t log_2(uint32_t val) {
+    uint8_t res = 0;
+
+    while (val >>= 1)
+        res++;
+
+    return res;
+}
+
+static blk_cnt_t *blk_find(uint32_t block) {
+    uint32_t i;
+
+    if (!block)
+        return &blk_zero;
+
+    if (tab_used * 2 >= tab_size) {
+        // grow
+        blk_cnt_t *old = tab;
+        uint32_t old_size = tab_size;
+
+        tab_size = tab_size ? tab_size * 2 : 4096;
+        tab = calloc(tab_size, sizeof(*tab));
+        if (!tab) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        tab_used = 0;
+        for (i = 0; i < old_size; i++) {
+            if (old[i].block)
+                *blk_find(old[i].block) = old[i];
+        }
+        free(old);
+    }
+
+    for (i = (block * 2654435761U) & (tab_size - 1); tab[i].block;
+         i = (i + 1) & (tab_size - 1)) {
+        if (tab[i].block == block)
+            return &tab[i];
+    }
+
+    tab[i].block = block;
+    tab_used++;
+
+    return &tab[i];
+}
+
+static int blk_hotter(const void *a, const void *b) {
+    const blk_cnt_t *x = a;
+    const blk_cnt_t *y = b;
+    uint64_t nx = (uint64_t)x->reads + x->writes;
+    uint64_t ny = (uint64_t)y->reads + y->writes;
+
+    if (nx != ny)
+        return (nx < ny) ? 1 : -1;
+
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+static int8_t null_request(req_t *req) {
+    (void)req;
+    return 0;
+}
+
+static const struct blk_dev_ops_s null_ops = {
+    .request = null_request,
+    .request_mb = null_request,
+};
+
+static int get_varint(FILE *in, uint32_t *val) {
+    int c;
+
+    *val = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        c = getc(in);
+        if (c == EOF)
+            return -1;
+        *val |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return 0;
+    }
+
+    return -1;
+}
+
+/*!
+ * @brief Account and replay one record
+ * @return 0 on success; -1 on broken record; 1 at the end of trace
+ */
+static int replay_rec(FILE *in, bdev_t *dev, uint16_t blk_size,
+                      uint32_t *next) {
+    uint32_t zz;
+    uint32_t cnt;
+    uint32_t offset = 0;
+    uint32_t count = 0;
+    uint32_t hash = 0;
+    uint32_t block;
+    int32_t delta;
+    uint8_t op;
+    int c;
+
+    c = getc(in);
+    if (c == EOF)
+        return 1;
+    op = c;
+
+    if (get_varint(in, &zz) || get_varint(in, &cnt) || !cnt ||
+        ((op & TR_OP_MASK) > TR_DISCARD))
+        return -1;
+    if ((op & TR_PART) &&
+        (get_varint(in, &offset) || get_varint(in, &count)))
+        return -1;
+    if (op & TR_HASH) {
+        for (uint8_t i = 0; i < 4; i++) {
+            c = getc(in);
+            if (c == EOF)
+                return -1;
+            hash |= (uint32_t)c << (i * 8);
+        }
+    }
+
+    delta = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+    block = *next + delta;
+    *next = block + cnt;
+
+    rec_num[op & TR_OP_MASK]++;
+    rec_blocks[op & TR_OP_MASK] += cnt;
+    if (op & TR_ERR)
+        errors++;
+    if (op & TR_PART)
+        partial++;
+
+    // sequential runs and jumps
+    if (!delta) {
+        seq_reqs++;
+        run_blocks += cnt;
+    } else {
+        uint32_t dist = (delta < 0) ? -(uint32_t)delta : (uint32_t)delta;
+
+        jump_hist[log_2(dist) + 1]++;
+        runs++;
+        run_blocks = cnt;
+    }
+    if (run_blocks > run_max)
+        run_max = run_blocks;
+
+    if ((op & TR_OP_MASK) == TR_DISCARD)
+        return blk_discard(dev, block, cnt) ? -1 : 0;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        blk_cnt_t *bc = blk_find(block + i);
+
+        if ((op & TR_OP_MASK) == TR_WRITE)
+            bc->writes++;
+        else
+            bc->reads++;
+    }
+
+    if (op & TR_ERR)
+        // failed on the device; not replayed
+        return 0;
+
+    if (cnt * blk_size > buf_size) {
+        free(buf);
+        buf_size = cnt * blk_size;
+        buf = malloc(buf_size);
+        if (!buf) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    for (uint32_t i = 0; i < cnt; i += 0xFFFF) {
+        req_t req = {
+            .bdev = dev,
+            .cmd_flags = ((op & TR_OP_MASK) == TR_WRITE) ? REQ_WRITE : REQ_READ,
+            .block = block + i,
+            .blk_cnt = (cnt - i > 0xFFFF) ? 0xFFFF : cnt - i,
+            .buf = buf + i * blk_size,
+            .offset = offset,
+            .count = count,
+        };
+
+        if (req.cmd_flags == REQ_WRITE)
+            memset(req.buf, 0, (uint32_t)req.blk_cnt * blk_size);
+        if (blk_request(&req))
+            return -1;
+    }
+
+    if ((op & (TR_HASH | TR_OP_MASK)) == (TR_HASH | TR_READ)) {
+        hashed++;
+        if (blk_trace_hash(TRACE_HASH_INIT, buf,
+                           count ? count : cnt * blk_size) != hash)
+            mismatch++;
+    }
+
+    return 0;
+}
+
+static void report(const sd_cost_t *cost, uint8_t checked) {
+    static const char *const op_name[] = {"read", "write", "discard"};
+    uint64_t reqs = rec_num[0] + rec_num[1] + rec_num[2];
+    uint32_t uniq_rd = 0;
+    uint32_t uniq_wr = 0;
+    uint64_t re_rd = 0;
+    uint64_t re_wr = 0;
+    blk_cnt_t *hot;
+    uint32_t n = 0;
+
+    printf("requests: %llu\n", (unsigned long long)reqs);
+    for (uint8_t i = 0; i < 3; i++)
+        printf("  %-8s %8lu requests %10llu blocks\n", op_name[i],
+               (unsigned long)rec_num[i], (unsigned long long)rec_blocks[i]);
+    printf("  failed %lu, partial reads %lu\n", (unsigned long)errors,
+           (unsigned long)partial);
+
+    printf("sequential: %lu of %llu requests (%.1f%%), %lu runs, "
+           "longest %llu blocks\n", (unsigned long)seq_reqs,
+           (unsigned long long)reqs, reqs ? 100.0 * seq_reqs / reqs : 0.0,
+           (unsigned long)runs, (unsigned long long)run_max);
+
+    printf("jump distance (blocks):\n");
+    for (uint8_t i = 1; i < HIST_BUCKETS; i++) {
+        if (jump_hist[i])
+            printf("  %10lu..%-10lu %8lu\n", 1UL << (i - 1),
+                   (i < 32) ? (1UL << i) - 1 : 0xFFFFFFFFUL,
+                   (unsigned long)jump_hist[i]);
+    }
+
+    hot = malloc((tab_used + 1) * sizeof(*hot));
+    if (hot && (blk_zero.reads || blk_zero.writes))
+        hot[n++] = blk_zero;
+    for (uint32_t i = 0; hot && (i < tab_size); i++) {
+        if (tab[i].block)
+            hot[n++] = tab[i];
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (hot[i].reads) {
+            uniq_rd++;
+            re_rd += hot[i].reads - 1;
+        }
+        if (hot[i].writes) {
+            uniq_wr++;
+            re_wr += hot[i].writes - 1;
+        }
+    }
+
+    printf("blocks: %lu read (%llu reads again), %lu written "
+           "(%llu writes again)\n", (unsigned long)uniq_rd,
+           (unsigned long long)re_rd, (unsigned long)uniq_wr,
+           (unsigned long long)re_wr);
+
+    if (hot) {
+        qsort(hot, n, sizeof(*hot), blk_hotter);
+        printf("hot blocks:\n");
+        for (uint32_t i = 0; (i < n) && (i < HOT_BLOCKS); i++)
+            printf("  %10lu %8lu reads %8lu writes\n",
+                   (unsigned long)hot[i].block, (unsigned long)hot[i].reads,
+                   (unsigned long)hot[i].writes);
+        free(hot);
+    }
+
+    printf("SD model: %lu commands, %.3f ms\n", (unsigned long)cost->cmds,
+           cost->time_ns / 1e6);
+    if (checked)
+        printf("data: %lu hashed reads, %lu mismatches\n",
+               (unsigned long)hashed, (unsigned long)mismatch);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: trace [options] TRACE\n"
+            "  -i IMAGE  replay to the image (it is modified by writes)\n"
+            "  -c US     command latency, us (default 100)\n"
+            "  -b NS     SPI time of a byte, ns (default 1000)\n"
+            "  -w US     write busy time of a block, us (default 250)\n"
+            "  -e US     erase command time, us (default 2000)\n");
+}
+
+int main(int argc, char **argv) {
+    const char *image = NULL;
+    const char *path = NULL;
+    uint8_t hdr[TRACE_HDR_LEN];
+    uint16_t blk_size;
+    uint32_t next = 0;
+    bdev_t lower = {0};
+    bdev_t sd;
+    sd_cost_t cost;
+    FILE *in;
+    int ret;
+
+    sd_cost_default(&cost);
+
+    for (int i = 1; i < argc; i++) {
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (argv[i][0] != '-') {
+            path = argv[i];
+            continue;
+        }
+        if (!val || (strlen(argv[i]) != 2)) {
+            usage();
+            return 2;
+        }
+        i++;
+        switch (argv[i - 1][1]) {
+            case 'i': image = val; break;
+            case 'c': cost.cmd_ns = atol(val) * 1000; break;
+            case 'b': cost.byte_ns = atol(val); break;
+            case 'w': cost.busy_ns = atol(val) * 1000; break;
+            case 'e': cost.erase_ns = atol(val) * 1000; break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+
+    if (!path) {
+        usage();
+        return 2;
+    }
+
+    in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return 1;
+    }
+    if ((fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr)) ||
+        memcmp(hdr, TRACE_MAGIC, 4) || (hdr[4] != TRACE_VERSION)) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        return 1;
+    }
+    blk_size = hdr[6] | (hdr[7] << 8);
+
+    if (image) {
+        if (file_bdev_open(&lower, image)) {
+            perror(image);
+            return 1;
+        }
+        if (lower.bd_blk_size != blk_size) {
+            fprintf(stderr, "%s: block size differs\n", image);
+            return 1;
+        }
+    } else {
+        lower.bd_blk_size = blk_size;
+        lower.bd_blk_num = 0xFFFFFFFF;
+        lower.bd_flags = BD_PART_READ;
+        lower.blk_ops = &null_ops;
+    }
+
+    sd_cost_init(&cost, &sd, &lower);
+
+    while (!(ret = replay_rec(in, &sd, blk_size, &next)))
+        ;
+    if (ret < 0)
+        fprintf(stderr, "%s: broken or failed record at offset %ld\n", path,
+                ftell(in));
+
+    report(&cost, image && (hdr[5] & BLK_TRACE_HASH));
+
+    fclose(in);
+    if (image)
+        file_bdev_close(&lower);
+    free(buf);
+    free(tab);
+
+    return (ret < 0) ? 1 : 0;
+}
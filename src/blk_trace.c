@@ -0,0 +1,146 @@
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+
+#include "block_dev.h"
+#include "blk_trace.h"
+
+/*!
+ * @brief Put unsigned LEB128 number to the record
+ * @param p Record position
+ * @param val Number
+ * @return Position after the number
+ */
+static uint8_t *trace_varint(uint8_t *p, uint32_t val) {
+    while (val >= 0x80) {
+        *p++ = (uint8_t)val | 0x80;
+        val >>= 7;
+    }
+    *p++ = (uint8_t)val;
+
+    return p;
+}
+
+/*!
+ * @brief Hash data with FNV-1a
+ * @param hash TRACE_HASH_INIT or hash of the previous data
+ * @param data Data
+ * @param len Length in bytes
+ * @return Hash
+ */
+uint32_t blk_trace_hash(uint32_t hash, const uint8_t *data, uint32_t len) {
+    while (len--) {
+        hash ^= *data++;
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/*!
+ * @brief Emit the record of a request
+ * @param trace Trace
+ * @param op TR_* op byte
+ * @param block First block
+ * @param cnt Number of blocks
+ * @param req Transfer request; NULL for discard
+ */
+static void trace_rec(blk_trace_t *trace, uint8_t op, uint32_t block,
+                      uint32_t cnt, const req_t *req) {
+    uint8_t rec[TRACE_REC_MAX];
+    uint8_t *p = rec + 1;
+    int32_t delta = block - trace->next;
+    uint32_t hash;
+
+    // zigzag: small steps back and forth take one byte
+    p = trace_varint(p, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    p = trace_varint(p, cnt);
+
+    if (req && req->count) {
+        op |= TR_PART;
+        p = trace_varint(p, req->offset);
+        p = trace_varint(p, req->count);
+    }
+
+    if (req && (trace->flags & BLK_TRACE_HASH) && !(op & TR_ERR)) {
+        op |= TR_HASH;
+        hash = blk_trace_hash(TRACE_HASH_INIT, req->buf,
+                              req->count ? req->count :
+                              cnt * req->bdev->bd_blk_size);
+        for (uint8_t i = 0; i < 4; i++, hash >>= 8)
+            *p++ = (uint8_t)hash;
+    }
+
+    rec[0] = op;
+    trace->next = block + cnt;
+    trace->put(rec, p - rec, trace->arg);
+}
+
+static int8_t trace_request(req_t *req) {
+    blk_trace_t *trace = blk_get_priv(req->bdev);
+    req_t lower = *req;
+    int8_t ret;
+
+    lower.bdev = trace->lower;
+    ret = blk_request(&lower);
+
+    trace_rec(trace, ((req->cmd_flags == REQ_WRITE) ? TR_WRITE : TR_READ) |
+                     (ret ? TR_ERR : 0),
+              req->block, req->blk_cnt ? req->blk_cnt : 1, &lower);
+
+    return ret;
+}
+
+static int8_t trace_discard(bdev_t *bdev, uint32_t block, uint32_t cnt) {
+    blk_trace_t *trace = blk_get_priv(bdev);
+    int8_t ret;
+
+    ret = blk_discard(trace->lower, block, cnt);
+    trace_rec(trace, TR_DISCARD | (ret ? TR_ERR : 0), block, cnt, NULL);
+
+    return ret;
+}
+
+static const struct blk_dev_ops_s trace_ops PROGMEM = {
+    .request = trace_request,
+    .request_mb = trace_request,
+    .discard = trace_discard,
+};
+
+/*!
+ * @brief Record requests to the device.
+ *        \p bdev is set up as \p lower that passes every request through
+ *        and puts its record to the trace; the header is put at once.
+ * @param trace Trace
+ * @param bdev Device to use instead of \p lower
+ * @param lower Traced device
+ * @param put Output of the trace
+ * @param arg Argument of \p put
+ * @param flags BLK_TRACE_*
+ * @return 0 on success
+ */
+int8_t blk_trace_init(blk_trace_t *trace, bdev_t *bdev, bdev_t *lower,
+                      trace_put_f put, void *arg, uint8_t flags) {
+    uint8_t hdr[TRACE_HDR_LEN] = TRACE_MAGIC;
+
+    if (!put)
+        return -1;
+
+    trace->lower = lower;
+    trace->put = put;
+    trace->arg = arg;
+    trace->next = 0;
+    trace->flags = flags;
+
+    *bdev = *lower;
+    bdev->blk_ops = &trace_ops;
+    blk_set_priv(bdev, trace);
+
+    hdr[4] = TRACE_VERSION;
+    hdr[5] = flags;
+    hdr[6] = (uint8_t)lower->bd_blk_size;
+    hdr[7] = lower->bd_blk_size >> 8;
+    put(hdr, sizeof(hdr), arg);
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef BLK_TRACE_H
+#define BLK_TRACE_H
+
+#include <stdint.h>
+
+#include "block_dev.h"
+
+/*
+ * Trace is a header followed by one record per request:
+ *   header: "FSTR", version, flags of blk_trace_init(), block size (LE16)
+ *   record: op byte (TR_*),
+ *           first block as zigzag delta from the end of the previous
+ *           request, number of blocks (all as LEB128 varints),
+ *           [offset, count]   if TR_PART,
+ *           [FNV-1a of data]  if TR_HASH (LE32)
+ */
+#define TRACE_MAGIC     "FSTR"
+#define TRACE_VERSION   1
+#define TRACE_HDR_LEN   8
+#define TRACE_REC_MAX   24  // longest record in bytes
+
+/* record op byte */
+#define TR_OP_MASK  0x03
+#define TR_READ     0x00
+#define TR_WRITE    0x01
+#define TR_DISCARD  0x02
+#define TR_PART     0x04    // partial read: offset and count follow
+#define TR_HASH     0x08    // hash of the data follows
+#define TR_ERR      0x10    // request failed
+
+/* blk_trace_init() flags */
+#define BLK_TRACE_HASH 0x01 // add hash of the data to read/write records
+
+typedef void (*trace_put_f)(const uint8_t *data, uint8_t len, void *arg);
+
+typedef struct blk_trace_s {
+    bdev_t *lower;      // device doing the transfers
+    trace_put_f put;    // output of the trace
+    void *arg;          // argument of put
+    uint32_t next;      // block after the previous request
+    uint8_t flags;      // BLK_TRACE_*
+} blk_trace_t;
+
+int8_t blk_trace_init(blk_trace_t *trace, bdev_t *bdev, bdev_t *lower,
+                      trace_put_f put, void *arg, uint8_t flags);
+uint32_t blk_trace_hash(uint32_t hash, const uint8_t *data, uint32_t len);
+
+#define TRACE_HASH_INIT 0x811C9DC5  // FNV-1a offset basis
+
+#endif  /* !BLK_TRACE_H */
@@ -0,0 +1,104 @@
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+
+#include "block_dev.h"
+#include "fs_stats.h"
+
+#if FS_STATS
+static fs_ticks_f stats_ticks;  // tick source of the latency histogram
+
+/*!
+ * @brief Set tick source for the request latency histogram
+ * @param ticks Function returning a free running counter; NULL - off
+ */
+void fs_stats_clock(fs_ticks_f ticks) {
+    stats_ticks = ticks;
+}
+
+/*!
+ * @brief Call driver and report the request to the statistics
+ */
+static int8_t req_call(req_f req_func, req_t *req) {
+    uint32_t start = 0;
+    int8_t ret;
+
+    if (stats_ticks)
+        start = stats_ticks();
+    ret = req_func(req);
+    if (!ret)
+        fs_stats_io(req, stats_ticks ? stats_ticks() - start
+                                     : FS_STATS_NO_TICKS);
+
+    return ret;
+}
+#else
+#define req_call(req_func, req) (req_func)(req)
+#endif  /* FS_STATS */
+
+/*!
+ * @brief Execute request on the block device.
+ *        Multiple block requests go to \a request_mb if the driver has it,
+ *        otherwise they are split into single block requests.
+ *        Partial reads (\a count != 0) require BD_PART_READ.
+ * @param req Request
+ * @return 0 on success
+ */
+int8_t blk_request(req_t *req) {
+    const struct blk_dev_ops_s *ops = req->bdev->blk_ops;
+    uint16_t blk_size = req->bdev->bd_blk_size ? req->bdev->bd_blk_size : 512;
+    req_f req_func;
+    req_t single;
+    int8_t ret;
+
+    if (req->count && ((req->cmd_flags != REQ_READ) || (req->blk_cnt > 1) ||
+                       !(req->bdev->bd_flags & BD_PART_READ)))
+        // partial transfer is not possible
+        return -1;
+
+    if (req->blk_cnt > 1) {
+        req_func = pgm_read_ptr(&ops->request_mb);
+        if (req_func)
+            return req_call(req_func, req);
+    }
+
+    req_func = pgm_read_ptr(&ops->request);
+    if (!req_func)
+        // no request function
+        return -1;
+
+    if (req->blk_cnt <= 1)
+        return req_call(req_func, req);
+
+    // driver can do single blocks only
+    single = *req;
+    single.blk_cnt = 1;
+    for (uint16_t i = 0; i < req->blk_cnt; i++) {
+        ret = req_call(req_func, &single);
+        if (ret)
+            return ret;
+        single.block++;
+        single.buf = (uint8_t *)single.buf + blk_size;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Tell the device that blocks are not used anymore.
+ *        The device may erase them in advance, so later writes to
+ *        the range don't wait for the erase.
+ *        Without \a discard operation the call does nothing.
+ * @param bdev Block device
+ * @param block First block
+ * @param cnt Number of blocks
+ * @return 0 on success
+ */
+int8_t blk_discard(bdev_t *bdev, uint32_t block, uint32_t cnt) {
+    discard_f discard = pgm_read_ptr(&bdev->blk_ops->discard);
+
+    if (!discard || !cnt)
+        return 0;
+
+    return discard(bdev, block, cnt);
+}
@@ -2,10 +2,14 @@
 #define BLOCK_DEVICE_H
 
 #include <stdint.h>
+#include <spi.h>
 
 typedef struct block_dev_s {
     uint16_t bd_blk_size;   // size of block (512 bytes by default)
     uint32_t bd_blk_num;    // number of blocks
+    uint32_t bd_au_size;    // allocation (erase) unit in blocks; 0 - unknown
+    uint8_t bd_flags;       // device capabilities
+#define BD_PART_READ 0x01   // driver handles offset/count of read requests
     const struct blk_dev_ops_s *blk_ops;  // block device operations
     void *priv;             // private data
 } bdev_t;
@@ -16,20 +20,29 @@ typedef struct request_s {
 #define REQ_READ 0
 #define REQ_WRITE 1
     uint32_t block;     // start block in LBA
-    void *buf;          // src or dst
-    // uint16_t offset;    // Offset from start of block in bytes; only for read
-    // uint16_t count;     // Number of bytes to read; 512 max; only for read
+    uint16_t blk_cnt;   // number of blocks to transfer (0 is the same as 1)
+    void *buf;          // src or dst (blk_cnt * bd_blk_size bytes)
+    uint16_t offset;    // Offset from start of block in bytes; only for read
+    uint16_t count;     // Number of bytes to read; 512 max; only for read
+                        // of a single block; 0 - whole block(s)
 } req_t;
 
 typedef int8_t (*req_f)(req_t *);
+typedef int8_t (*discard_f)(bdev_t *, uint32_t, uint32_t);
 
 struct blk_dev_ops_s {
     // int8_t (*open)(bdev_t *, uint8_t);
     // void (*release)(bdev_t *, uint8_t);
     // int8_t (*request)(struct request_s *);
-    req_f request;
+    req_f request;      // single block transfer (blk_cnt is ignored)
+    req_f request_mb;   // multiple block transfer (e.g. CMD18/CMD25); optional
+    discard_f discard;  // erase range of blocks (e.g. CMD32/CMD33/CMD38);
+                        // optional; content of the range becomes undefined
 };
 
+int8_t blk_request(req_t *req);
+int8_t blk_discard(bdev_t *bdev, uint32_t block, uint32_t cnt);
+
 static inline void blk_set_priv(bdev_t *bdev, void *priv) {
     bdev->priv = priv;
 }
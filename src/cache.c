@@ -0,0 +1,452 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cache.h"
+#include "block_dev.h"
+#include "fs_stats.h"
+
+/* slot flags */
+#define SLOT_VALID  0x01    // slot holds a block
+#define SLOT_DIRTY  0x02    // slot was modified and must be written back
+#define SLOT_CLASS_SHIFT 2  // bits 2-3: CACHE_* class of the modified block
+#define SLOT_CLASS(flags) (((flags) >> SLOT_CLASS_SHIFT) & 0x03)
+
+typedef struct cache_slot_s {
+    bdev_t *bdev;       // owner of the block
+    uint32_t block;     // block number in LBA
+    uint8_t flags;      // SLOT_*
+    uint8_t age;        // accesses since last use (saturated); 0 - MRU
+} cache_slot_t;
+
+static cache_slot_t slots[FS_CACHE_SLOTS];
+static uint8_t cache_buf[FS_CACHE_SLOTS][CACHE_SECT_SIZE];
+
+/*!
+ * @brief Transfer slot data to or from the device
+ * @param idx Slot index
+ * @param cmd REQ_READ or REQ_WRITE
+ * @return 0 on success
+ */
+static int8_t slot_io(uint8_t idx, uint8_t cmd) {
+    req_t req;
+
+    req.bdev = slots[idx].bdev;
+    req.cmd_flags = cmd;
+    req.block = slots[idx].block;
+    req.blk_cnt = 1;
+    req.buf = cache_buf[idx];
+    req.offset = 0;
+    req.count = 0;
+
+    return blk_request(&req);
+}
+
+/*!
+ * @brief Write slot back to the device if it is dirty
+ * @param idx Slot index
+ * @return 0 on success
+ */
+static int8_t slot_writeback(uint8_t idx) {
+    int8_t ret;
+
+    if ((slots[idx].flags & (SLOT_VALID | SLOT_DIRTY)) !=
+        (SLOT_VALID | SLOT_DIRTY))
+        return 0;
+
+    ret = slot_io(idx, REQ_WRITE);
+    if (!ret)
+        slots[idx].flags &= ~SLOT_DIRTY;
+
+    return ret;
+}
+
+/*!
+ * @brief Write back modified blocks in order of classes: file data,
+ *        then FAT, then directory entries
+ * @param bdev Block device; NULL for all devices
+ * @param cls The last class to write
+ * @return 0 on success
+ */
+static int8_t cache_writeback(bdev_t *bdev, uint8_t cls) {
+    int8_t ret = 0;
+
+    for (uint8_t c = CACHE_DATA; c <= cls; c++) {
+        for (uint8_t i = 0; i < FS_CACHE_SLOTS; i++) {
+            if ((bdev && (slots[i].bdev != bdev)) ||
+                (SLOT_CLASS(slots[i].flags) != c))
+                continue;
+            if (slot_writeback(i))
+                ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*!
+ * @brief Write slot back keeping the order of classes: modified blocks
+ *        of the preceding classes on the device are written first
+ * @param idx Slot index
+ * @return 0 on success
+ */
+static int8_t slot_flush(uint8_t idx) {
+    uint8_t cls = SLOT_CLASS(slots[idx].flags);
+
+    if (!(slots[idx].flags & SLOT_DIRTY))
+        return 0;
+
+    if (cls && cache_writeback(slots[idx].bdev, cls - 1))
+        return -1;
+
+    return slot_writeback(idx);
+}
+
+/*!
+ * @brief Mark slot as most recently used
+ * @param idx Slot index
+ */
+static void slot_touch(uint8_t idx) {
+    for (uint8_t i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (slots[i].age != 0xFF)
+            slots[i].age++;
+#if FS_CACHE_WB_AGE
+        if ((slots[i].age == FS_CACHE_WB_AGE) && (i != idx))
+            // unused for long; an error is left to the next flush
+            slot_flush(i);
+#endif  /* FS_CACHE_WB_AGE */
+    }
+    slots[idx].age = 0;
+}
+
+/*!
+ * @brief Find slot to reuse: empty one or least recently used
+ * @return Slot index
+ */
+static uint8_t slot_victim(void) {
+    uint8_t victim = 0;
+
+    for (uint8_t i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (!(slots[i].flags & SLOT_VALID))
+            return i;
+        if (slots[i].age > slots[victim].age)
+            victim = i;
+    }
+
+    return victim;
+}
+
+/*!
+ * @brief Get block through the sector cache
+ * @param bdev Block device
+ * @param block Block number in LBA
+ * @param flags CACHE_READ or CACHE_NOREAD
+ * @return Pointer to 512 bytes of block data; NULL on error.
+ *         Pointer is valid until the next cache call.
+ */
+uint8_t *cache_get(bdev_t *bdev, uint32_t block, uint8_t flags) {
+    uint8_t idx;
+
+    for (idx = 0; idx < FS_CACHE_SLOTS; idx++) {
+        if ((slots[idx].flags & SLOT_VALID) &&
+            (slots[idx].bdev == bdev) && (slots[idx].block == block)) {
+            // hit
+#if FS_STATS
+            fs_stats_cache(bdev, block, 1);
+#endif  /* FS_STATS */
+            slot_touch(idx);
+            return cache_buf[idx];
+        }
+    }
+
+    // miss
+#if FS_STATS
+    fs_stats_cache(bdev, block, 0);
+#endif  /* FS_STATS */
+    idx = slot_victim();
+    if (slot_flush(idx))
+        // the old block can't be stored
+        return NULL;
+
+    slots[idx].bdev = bdev;
+    slots[idx].block = block;
+    slots[idx].flags = 0;
+
+    if (!(flags & CACHE_NOREAD) && slot_io(idx, REQ_READ))
+        // some err
+        return NULL;
+
+    slots[idx].flags = SLOT_VALID;
+    slot_touch(idx);
+
+    return cache_buf[idx];
+}
+
+/*!
+ * @brief Mark cached block as modified.
+ *        The block stays in the cache until it is evicted or flushed.
+ * @param buf Pointer returned by cache_get() (or anywhere inside that block)
+ * @param cls CACHE_DATA, CACHE_FAT or CACHE_DIR; sets order of writing
+ */
+void cache_dirty(const void *buf, uint8_t cls) {
+    ptrdiff_t pos = (const uint8_t *)buf - cache_buf[0];
+    cache_slot_t *slot;
+
+    if ((pos < 0) || (pos >= (ptrdiff_t)sizeof(cache_buf)))
+        // not a cache buffer
+        return;
+
+    slot = &slots[pos / CACHE_SECT_SIZE];
+    slot->flags = (slot->flags & ~(0x03 << SLOT_CLASS_SHIFT)) |
+                  SLOT_DIRTY | (cls << SLOT_CLASS_SHIFT);
+}
+
+/*!
+ * @brief Write all modified blocks back to the device: file data first,
+ *        then FAT, then directory entries
+ * @param bdev Block device; NULL for all devices
+ * @return 0 on success
+ */
+int8_t cache_flush(bdev_t *bdev) {
+    return cache_writeback(bdev, CACHE_DIR);
+}
+
+/*!
+ * @brief Drop cached blocks of the range without writing them back
+ * @param bdev Block device
+ * @param block First block
+ * @param cnt Number of blocks
+ */
+void cache_invalidate(bdev_t *bdev, uint32_t block, uint32_t cnt) {
+    for (uint8_t i = 0; i < FS_CACHE_SLOTS; i++) {
+        if ((slots[i].bdev == bdev) && (slots[i].block >= block) &&
+            (slots[i].block - block < cnt))
+            slots[i].flags = 0;
+    }
+}
+
+/*!
+ * @brief Keep the cache coherent with a transfer that bypasses it.
+ *        Before a read, modified blocks of the range are written back;
+ *        before a write, cached copies of the range are dropped.
+ * @param bdev Block device
+ * @param block First block of the transfer
+ * @param cnt Number of blocks
+ * @param cmd REQ_READ or REQ_WRITE
+ * @return 0 on success
+ */
+int8_t cache_sync_range(bdev_t *bdev, uint32_t block, uint16_t cnt,
+                        uint8_t cmd) {
+    for (uint8_t i = 0; i < FS_CACHE_SLOTS; i++) {
+        if (!(slots[i].flags & SLOT_VALID) || (slots[i].bdev != bdev) ||
+            (slots[i].block < block) || (slots[i].block - block >= cnt))
+            continue;
+
+        if (cmd == REQ_WRITE)
+            slots[i].flags = 0;
+        else if (slot_writeback(i))
+            return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Read a byte range of a block.
+ *        A cached block is copied from RAM. Otherwise the range is read
+ *        directly into \p buf if the driver supports partial reads, and
+ *        through a cache slot if it does not.
+ * @param bdev Block device
+ * @param block Block number in LBA
+ * @param offset Offset from start of block in bytes
+ * @param count Number of bytes
+ * @param buf Destination (\p count bytes)
+ * @return 0 on success
+ */
+int8_t cache_read_part(bdev_t *bdev, uint32_t block, uint16_t offset,
+                       uint16_t count, void *buf) {
+    uint8_t *data;
+    req_t req;
+
+    if (((uint32_t)offset + count) > CACHE_SECT_SIZE)
+        return -1;
+
+    for (uint8_t i = 0; i < FS_CACHE_SLOTS; i++) {
+        if ((slots[i].flags & SLOT_VALID) &&
+            (slots[i].bdev == bdev) && (slots[i].block == block)) {
+            memcpy(buf, cache_buf[i] + offset, count);
+            return 0;
+        }
+    }
+
+    if (bdev->bd_flags & BD_PART_READ) {
+        req.bdev = bdev;
+        req.cmd_flags = REQ_READ;
+        req.block = block;
+        req.blk_cnt = 1;
+        req.buf = buf;
+        req.offset = offset;
+        req.count = count;
+
+        return blk_request(&req);
+    }
+
+    data = cache_get(bdev, block, CACHE_READ);
+    if (!data)
+        return -1;
+    memcpy(buf, data + offset, count);
+
+    return 0;
+}
+
+/*!
+ * @brief Read consecutive blocks into the cache with one multi-block
+ *        request. The blocks go to adjacent slots, which form one buffer;
+ *        the slots with the oldest data are taken. The most recently used
+ *        slot (e.g. FAT sector of the chain being read) is kept.
+ * @param bdev Block device
+ * @param block First block
+ * @param cnt Number of blocks; the read stops before the first block
+ *            that is cached already and is limited by FS_CACHE_SLOTS - 1
+ * @return Number of blocks read (0 if \p block is cached); -1 on error
+ */
+int8_t cache_prefetch(bdev_t *bdev, uint32_t block, uint8_t cnt) {
+    uint16_t best = 0;
+    uint16_t age;
+    uint8_t first = 0;
+    req_t req;
+
+    if (cnt > FS_CACHE_SLOTS - 1)
+        cnt = FS_CACHE_SLOTS - 1;
+
+    for (uint8_t i = 0; i < FS_CACHE_SLOTS; i++) {
+        if ((slots[i].flags & SLOT_VALID) && (slots[i].bdev == bdev) &&
+            (slots[i].block >= block) && (slots[i].block - block < cnt))
+            cnt = slots[i].block - block;
+    }
+
+    if (!cnt)
+        return 0;
+
+    // only a run without the MRU slot (age 0) is taken; shorten it if
+    // there is no such run
+    for (;;) {
+        for (uint8_t i = 0; i + cnt <= FS_CACHE_SLOTS; i++) {
+            // the run is as old as its most recently used slot
+            age = 0x100;
+            for (uint8_t j = i; j < i + cnt; j++) {
+                if ((slots[j].flags & SLOT_VALID) && (slots[j].age < age))
+                    age = slots[j].age;
+            }
+            if (age > best) {
+                best = age;
+                first = i;
+            }
+        }
+        if (best)
+            break;
+        if (!--cnt)
+            return 0;
+    }
+
+    for (uint8_t i = first; i < first + cnt; i++) {
+        if (slot_flush(i))
+            return -1;
+        slots[i].flags = 0;
+    }
+
+    req.bdev = bdev;
+    req.cmd_flags = REQ_READ;
+    req.block = block;
+    req.blk_cnt = cnt;
+    req.buf = cache_buf[first];
+    req.offset = 0;
+    req.count = 0;
+
+    if (blk_request(&req))
+        return -1;
+
+    // the first block is to be used first
+    for (uint8_t i = first + cnt; i-- > first;) {
+        slots[i].bdev = bdev;
+        slots[i].block = block + (i - first);
+        slots[i].flags = SLOT_VALID;
+        slot_touch(i);
+    }
+
+    return cnt;
+}
+
+/*!
+ * @brief Copy blocks within the device.
+ *        Blocks go through the cache slots: up to FS_CACHE_SLOTS blocks
+ *        with one multi-block read and one multi-block write. The slots
+ *        are left holding the source blocks.
+ * @param bdev Block device
+ * @param src First source block
+ * @param dst First destination block
+ * @param cnt Number of blocks
+ * @return 0 on success
+ */
+int8_t cache_copy(bdev_t *bdev, uint32_t src, uint32_t dst, uint32_t cnt) {
+    uint8_t n;
+    req_t req;
+
+    req.bdev = bdev;
+    req.buf = cache_buf[0];
+    req.offset = 0;
+    req.count = 0;
+
+    while (cnt) {
+        n = (cnt < FS_CACHE_SLOTS) ? cnt : FS_CACHE_SLOTS;
+
+        if (cache_sync_range(bdev, src, n, REQ_READ) ||
+            cache_sync_range(bdev, dst, n, REQ_WRITE))
+            return -1;
+
+        for (uint8_t i = 0; i < n; i++) {
+            if (slot_flush(i))
+                return -1;
+            slots[i].flags = 0;
+        }
+
+        req.blk_cnt = n;
+        req.cmd_flags = REQ_READ;
+        req.block = src;
+        if (blk_request(&req))
+            return -1;
+
+        req.cmd_flags = REQ_WRITE;
+        req.block = dst;
+        if (blk_request(&req))
+            return -1;
+
+        for (uint8_t i = 0; i < n; i++) {
+            slots[i].bdev = bdev;
+            slots[i].block = src + i;
+            slots[i].flags = SLOT_VALID;
+            slots[i].age = 0xFF;
+        }
+
+        src += n;
+        dst += n;
+        cnt -= n;
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Discard blocks on the device.
+ *        Cached copies of the range are dropped even if modified:
+ *        the content is not needed anymore.
+ * @param bdev Block device
+ * @param block First block
+ * @param cnt Number of blocks
+ * @return 0 on success
+ */
+int8_t cache_discard(bdev_t *bdev, uint32_t block, uint32_t cnt) {
+    cache_invalidate(bdev, block, cnt);
+
+    return blk_discard(bdev, block, cnt);
+}
@@ -0,0 +1,40 @@
+#ifndef FS_CACHE_H
+#define FS_CACHE_H
+
+#include <stdint.h>
+
+#include "block_dev.h"
+
+#ifndef FS_CACHE_SLOTS
+#define FS_CACHE_SLOTS 2    // number of sector slots (512 bytes of RAM each)
+#endif  /* !FS_CACHE_SLOTS */
+
+#ifndef FS_CACHE_WB_AGE
+#define FS_CACHE_WB_AGE 0   // write back a dirty slot unused for this many
+                            // cache accesses (up to 255); 0 - off
+#endif  /* !FS_CACHE_WB_AGE */
+
+#define CACHE_SECT_SIZE 512 // size of one cache slot in bytes
+
+/* cache_get() flags */
+#define CACHE_READ      0x00    // read block from the device on a miss
+#define CACHE_NOREAD    0x01    // block will be overwritten entirely, don't read
+
+/* cache_dirty() classes, in order of writing back */
+#define CACHE_DATA      0x00    // file data
+#define CACHE_FAT       0x01    // allocation table, FSInfo
+#define CACHE_DIR       0x02    // directory entries
+
+uint8_t *cache_get(bdev_t *bdev, uint32_t block, uint8_t flags);
+void cache_dirty(const void *buf, uint8_t cls);
+int8_t cache_flush(bdev_t *bdev);
+void cache_invalidate(bdev_t *bdev, uint32_t block, uint32_t cnt);
+int8_t cache_read_part(bdev_t *bdev, uint32_t block, uint16_t offset,
+                       uint16_t count, void *buf);
+int8_t cache_sync_range(bdev_t *bdev, uint32_t block, uint16_t cnt,
+                        uint8_t cmd);
+int8_t cache_prefetch(bdev_t *bdev, uint32_t block, uint8_t cnt);
+int8_t cache_copy(bdev_t *bdev, uint32_t src, uint32_t dst, uint32_t cnt);
+int8_t cache_discard(bdev_t *bdev, uint32_t block, uint32_t cnt);
+
+#endif  /* !FS_CACHE_H */
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#include "fs.h"
+#include "dcache.h"
+#include "dirent.h"
+
+#if FS_DCACHE_SIZE
+
+typedef struct dcache_ent_s {
+    fs_volume_t *vol;   // volume; NULL if entry is free
+    uint32_t parent;    // start cluster of the parent directory
+    uint16_t hash;      // hash of the name
+    uint8_t len;        // length of the name
+    uint8_t age;        // lookups since last hit (saturated)
+    char name[DCACHE_NAME_LEN]; // name in upper case
+    uint32_t clust;     // start cluster of the object
+    uint32_t sect;      // first sector of the object
+    uint32_t ent_sect;  // sector with the entry of the object
+    uint8_t ent_idx;    // index of the entry in ent_sect
+    uint8_t type;       // DT_*
+} dcache_ent_t;
+
+static dcache_ent_t dcache[FS_DCACHE_SIZE];
+
+static void dcache_touch(dcache_ent_t *ent) {
+    for (uint8_t i = 0; i < FS_DCACHE_SIZE; i++) {
+        if (dcache[i].age != 0xFF)
+            dcache[i].age++;
+    }
+    ent->age = 0;
+}
+
+/*!
+ * @brief Find previously resolved name
+ * @param dir Directory to look in; on hit it is replaced by the object found
+ * @param name Name to find
+ * @return 0 on hit; -1 on miss
+ */
+int8_t dcache_lookup(DIR *dir, const fs_name_t *name) {
+    dcache_ent_t *ent = dcache;
+    uint8_t i;
+
+    for (uint8_t n = 0; n < FS_DCACHE_SIZE; n++, ent++) {
+        if ((ent->vol != dir->vol) || (ent->parent != dir->clust) ||
+            (ent->hash != name->hash) || (ent->len != name->len))
+            continue;
+
+        for (i = 0; i < ent->len; i++) {
+            if (ent->name[i] != toupper(fs_name_char(name, i)))
+                break;
+        }
+        if (i != ent->len)
+            // hash collision
+            continue;
+
+        dir->clust = ent->clust;
+        dir->sect = ent->sect;
+        dir->offset = 0;
+        dir->entry = NULL;
+        dir->ent_sect = ent->ent_sect;
+        dir->ent_idx = ent->ent_idx;
+        dir->type = ent->type;
+        dcache_touch(ent);
+
+        return 0;
+    }
+
+    return -1;
+}
+
+/*!
+ * @brief Remember resolved name
+ * @param parent Start cluster of the directory \p name was looked up in
+ * @param name Name
+ * @param dir Object found by \p name
+ */
+void dcache_add(uint32_t parent, const fs_name_t *name, const DIR *dir) {
+    dcache_ent_t *ent = dcache;
+
+    if (name->len > DCACHE_NAME_LEN)
+        return;
+
+    for (uint8_t i = 0; i < FS_DCACHE_SIZE; i++) {
+        // a free slot wins over the oldest one
+        if (!dcache[i].vol) {
+            ent = &dcache[i];
+            break;
+        }
+        if (dcache[i].age > ent->age)
+            ent = &dcache[i];
+    }
+
+    ent->vol = dir->vol;
+    ent->parent = parent;
+    ent->hash = name->hash;
+    ent->len = name->len;
+    for (uint8_t i = 0; i < name->len; i++)
+        ent->name[i] = toupper(fs_name_char(name, i));
+    ent->clust = dir->clust;
+    ent->sect = dir->sect;
+    ent->ent_sect = dir->ent_sect;
+    ent->ent_idx = dir->ent_idx;
+    ent->type = dir->type;
+    dcache_touch(ent);
+}
+
+/*!
+ * @brief Forget all names of the volume
+ * @param vol Volume; NULL for all volumes
+ */
+void dcache_invalidate(const fs_volume_t *vol) {
+    for (uint8_t i = 0; i < FS_DCACHE_SIZE; i++) {
+        if (!vol || (dcache[i].vol == vol))
+            dcache[i].vol = NULL;
+    }
+}
+
+#else   /* !FS_DCACHE_SIZE */
+
+int8_t dcache_lookup(DIR *dir, const fs_name_t *name) {
+    return -1;
+}
+
+void dcache_add(uint32_t parent, const fs_name_t *name, const DIR *dir) {
+}
+
+void dcache_invalidate(const fs_volume_t *vol) {
+}
+
+#endif  /* FS_DCACHE_SIZE */
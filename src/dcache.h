@@ -0,0 +1,19 @@
+#ifndef FS_DCACHE_H
+#define FS_DCACHE_H
+
+#include <stdint.h>
+
+#include "fs.h"
+#include "dirent.h"
+
+#ifndef FS_DCACHE_SIZE
+#define FS_DCACHE_SIZE 4    // number of cached lookups; 0 - disable
+#endif  /* !FS_DCACHE_SIZE */
+
+#define DCACHE_NAME_LEN 12  // longest name to cache ("FILENAME.EXT")
+
+int8_t dcache_lookup(DIR *dir, const fs_name_t *name);
+void dcache_add(uint32_t parent, const fs_name_t *name, const DIR *dir);
+void dcache_invalidate(const fs_volume_t *vol);
+
+#endif  /* !FS_DCACHE_H */
@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirent.h"
+
+/* Entry kept by scandir() */
+typedef struct scan_ent_s {
+    struct dirent dent;
+    uint32_t ord;               // ordinal in directory; makes order total
+    char name[FS_NAME_MAX + 1];
+} scan_ent_t;
+
+static int8_t (*scan_compar)(const struct dirent **, const struct dirent **);
+
+/*!
+ * @brief Compare entries by \a scan_compar; equal ones by position
+ */
+static int8_t scan_cmp(const scan_ent_t *e1, const scan_ent_t *e2) {
+    const struct dirent *d1 = &e1->dent;
+    const struct dirent *d2 = &e2->dent;
+    int8_t ret = scan_compar(&d1, &d2);
+
+    if (ret)
+        return ret;
+
+    return (e1->ord > e2->ord) - (e1->ord < e2->ord);
+}
+
+static int scan_qsort_cmp(const void *p1, const void *p2) {
+    return scan_cmp(*(scan_ent_t *const *)p1, *(scan_ent_t *const *)p2);
+}
+
+static void scan_copy(scan_ent_t *ent, const struct dirent *dent,
+                      uint32_t ord) {
+    strcpy(ent->name, dent->d_name);
+    ent->dent.d_type = dent->d_type;
+    ent->ord = ord;
+}
+
+/*!
+ * @brief Compare names of directory entries
+ * @param d1 First entry
+ * @param d2 Second entry
+ * @return <0, 0 or >0 like strcmp()
+ */
+int8_t alphasort(const struct dirent **d1, const struct dirent **d2) {
+    int ret = strcmp((*d1)->d_name, (*d2)->d_name);
+
+    return (ret > 0) - (ret < 0);
+}
+
+/*!
+ * @brief Scan directory in sorted order within the given RAM.
+ *        Unlike POSIX version, no memory is allocated for entries:
+ *        \p buf holds as many entries as fit, and the directory is read
+ *        in passes. Each pass keeps the smallest entries that follow the
+ *        last one passed to \p func, sorts them and passes them on.
+ *        A directory that fits \p buf is sorted in one pass.
+ * @param dir Pathname of the directory
+ * @param buf Work memory (aligned as for malloc())
+ * @param size Size of \p buf in bytes; at least two entries
+ *             (2 * (FS_NAME_MAX + 10) bytes or so) must fit
+ * @param sel Filter; entries for which it returns 0 are skipped.
+ *            NULL to take all entries
+ * @param compar Comparison function (e.g. alphasort)
+ * @param func Called for every entry in sorted order; nonzero return
+ *             stops the scan. Entry is valid until \p func returns
+ * @param arg Argument passed to \p func
+ * @return Number of entries passed to \p func; -1 on error
+ */
+int32_t scandir(const char *dir, void *buf, uint16_t size,
+                int8_t (*sel)(const struct dirent *),
+                int8_t (*compar)(const struct dirent **,
+                                 const struct dirent **),
+                int8_t (*func)(const struct dirent *, void *),
+                void *arg) {
+    uint16_t cap = (size < sizeof(scan_ent_t)) ? 0 :
+                   (size - sizeof(scan_ent_t)) /
+                   (sizeof(scan_ent_t) + sizeof(scan_ent_t *));
+    scan_ent_t **list = buf;
+    scan_ent_t *ents = (scan_ent_t *)(list + cap);
+    scan_ent_t *last = ents + cap;  // last entry passed to func
+    scan_ent_t cur;
+    struct dirent *dent;
+    DIR *dirp;
+    uint16_t cnt;
+    uint16_t max;
+    uint32_t ord;
+    int32_t total = 0;
+    uint8_t more;
+
+    if (!buf || !cap || !compar || !func)
+        // ENOMEM, EINVAL
+        return -1;
+
+    dirp = opendir(dir);
+    if (!dirp)
+        return -1;
+
+    scan_compar = compar;
+    for (uint16_t i = 0; i <= cap; i++)
+        ents[i].dent.d_name = ents[i].name;
+    cur.dent.d_name = cur.name;
+
+    do {
+        more = 0;
+        cnt = 0;
+        max = 0;
+        ord = 0;
+        rewinddir(dirp);
+
+        for (;;) {
+            dent = readdir(dirp);
+            if (!dent)
+                break;
+            cur.ord = ord++;
+            if (sel && !sel(dent))
+                continue;
+
+            scan_copy(&cur, dent, cur.ord);
+            if (total && (scan_cmp(&cur, last) <= 0))
+                // already passed
+                continue;
+
+            if (cnt < cap) {
+                list[cnt] = &ents[cnt];
+                *list[cnt] = cur;
+                list[cnt]->dent.d_name = list[cnt]->name;
+                if (scan_cmp(list[cnt], list[max]) > 0)
+                    max = cnt;
+                cnt++;
+                continue;
+            }
+
+            // no space; is left for the next pass
+            more = 1;
+            if (scan_cmp(&cur, list[max]) >= 0)
+                continue;
+
+            // replace the greatest entry
+            scan_copy(list[max], dent, cur.ord);
+            for (uint16_t i = 0; i < cnt; i++) {
+                if (scan_cmp(list[i], list[max]) > 0)
+                    max = i;
+            }
+        }
+
+        qsort(list, cnt, sizeof(*list), scan_qsort_cmp);
+
+        for (uint16_t i = 0; i < cnt; i++, total++) {
+            if (func(&list[i]->dent, arg)) {
+                closedir(dirp);
+                return total + 1;
+            }
+        }
+
+        if (cnt) {
+            *last = *list[cnt - 1];
+            last->dent.d_name = last->name;
+        }
+    } while (more);
+
+    closedir(dirp);
+
+    return total;
+}
@@ -17,14 +17,31 @@ typedef struct __dirstream {
     void *entry;        // pointer to the directory entry
     uint8_t ent_size;   // entry size
     char *name;         // pointer to dir name
+    uint32_t ent_sect;  // sector with the own entry of this object (0 - root)
+    uint8_t ent_idx;    // index of the own entry in ent_sect
+    uint8_t type;       // object type (DT_*)
 } DIR;
 
+#ifndef FS_NAME_MAX
+#define FS_NAME_MAX 64  // max length of d_name; longer names are read as 8.3
+#endif  /* !FS_NAME_MAX */
+
+#if FS_NAME_MAX < 12
+#error "FS_NAME_MAX must fit 8.3 name"
+#endif
+
+/* object types */
+#define DT_UNKNOWN  0   // unknown type
+#define DT_DIR      4   // directory
+#define DT_REG      8   // regular file
+
 struct dirent {
     // ino_t d_ino;    // File serial number
     char *d_name;   // Filename string of entry
+    uint8_t d_type; // Type of entry (DT_*)
 };
 
-// int8_t alphasort(const struct dirent **d1, const struct dirent **d2);
+int8_t alphasort(const struct dirent **d1, const struct dirent **d2);
 int8_t closedir(DIR *dirp);
 // int dirfd(DIR *dirp);
 // DIR *fdopendir(int fd);
@@ -34,12 +51,13 @@ struct dirent *readdir(DIR *dirp);
 //                  struct dirent *restrict entry,
 //                  struct dirent **restrict result);
 void rewinddir(DIR *dirp);
-// int8_t scandir(const char *dir,
-//                struct dirent ***namelist,
-//                int (*sel)(const struct dirent *),
-//                int (*compar)(const struct dirent **,
-//                const struct dirent **));
-// void seekdir(DIR *dirp, long lock);
-// long telldir(DIR *dirp);
+int32_t scandir(const char *dir, void *buf, uint16_t size,
+                int8_t (*sel)(const struct dirent *),
+                int8_t (*compar)(const struct dirent **,
+                                 const struct dirent **),
+                int8_t (*func)(const struct dirent *, void *),
+                void *arg);
+void seekdir(DIR *dirp, long loc);
+long telldir(DIR *dirp);
 
 #endif  /* !SYS_DIRENT_H */
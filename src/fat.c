@@ -4,166 +4,265 @@
 #include <stdlib.h>
 
 #include "fs.h"
+#include "fat.h"
+#include "cache.h"
 
-/* FAT types */
-#define FAT12 0 // FAT12
-#define FAT16 1 // FAT16
-#define FAT32 2 // FAT32
-#define FAT64 3 // exFAT
-
-/* EOC */
-#define FAT12_EOC 0x0FF8
-#define FAT16_EOC 0xFFF8
-#define FAT32_EOC 0x0FFFFFF8
-
-/* Bad cluster value */
-#define FAT12_BAD 0x0FF7
-#define FAT16_BAD 0xFFF7
-#define FAT32_BAD 0x0FFFFFF7
-
-struct __attribute__((packed)) BPB_s {
-    uint8_t BS_jmpBoot[3];      // Jump instruction to boot code
-    uint8_t BS_OEMName[8];      // Name string (e.g. "MSWIN4.1")
-    uint16_t BPB_BytsPerSec;    // Count of bytes per sector
-    uint8_t BPB_SecPerClus;     // Number of sectors per allocation unit
-    uint16_t BPB_RsvdSecCnt;    // Number of reserved sectors in the Reserved region of the volume starting at the first sector of the volume. This field must not be 0. 
-    uint8_t BPB_NumFATs;        // The count of FAT data structures on the volume
-    uint16_t BPB_RootEntCnt;    // For FAT12 and FAT16, this field contains the count of 32-byte directory entries in the root directory. For FAT32, this field must be set to 0
-    uint16_t BPB_TotSec16;      // This field is the old 16-bit total count of sectors on the volume
-    uint8_t BPB_Media;          // 0xF8 is the standard value for “fixed” (non-removable) media
-    uint16_t BPB_FATSz16;       // This field is the FAT12/FAT16 16-bit count of sectors occupied by ONE FAT. On FAT32 this field must be 0, and BPB_FATSz32 contains the FAT size count
-    uint16_t BPB_SecPerTrk;     // Sectors per track for interrupt 0x13
-    uint16_t BPB_NumHeads;      // Number of heads for interrupt 0x13
-    uint32_t BPB_HiddSec;       // Count of hidden sectors preceding the partition that contains this FAT volume
-    uint32_t BPB_TotSec32;      // This field is the new 32-bit total count of sectors on the volume
-
-    union {
-        struct __attribute__((packed)) {
-            uint8_t BS_DrvNum;          // Int 0x13 drive number (e.g. 0x80)
-            uint8_t BS_Reserved1;       // Reserved (used by Windows NT)
-            uint8_t BS_BootSig;         // Extended boot signature (0x29)
-            uint32_t BS_VolID;          // Volume serial number
-            uint8_t BS_VolLab[11];      // Volume label
-            uint8_t BS_FilSysType[8];   // One of the strings "FAT12   ", "FAT16   ", or "FAT     "
-            uint8_t BS_bootCode[448];   // Bootstrap code
-        } fat12_16_ext;
-        struct __attribute__((packed)) {
-            uint32_t BPB_FATSz32;       // Count of sectors occupied by ONE FAT. BPB_FATSz16 must be 0
-            uint16_t BPB_ExtFlags;      // Flags
-            uint16_t BPB_FSVer;         // Version number of the FAT32 volume (maj.min)
-            uint32_t BPB_RootClus;      // This is set to the cluster number of the first cluster of the root directory, usually 2 but not required to be 2
-            uint16_t BPB_FSInfo;        // Sector number of FSINFO structure in the reserved area. Usually 1
-            uint16_t BPB_BkBootSec;     // If non-zero, indicates the sector number in the reserved area of the volume of a copy of the boot record. Usually 6. No value other than 6 is recommended.
-            uint8_t BPB_Reserved[12];   // Reserved for future expansion
-            uint8_t BS_DrvNum;          // Int 0x13 drive number (e.g. 0x80)
-            uint8_t BS_Reserved1;       // Reserved (used by Windows NT)
-            uint8_t BS_BootSig;         // Extended boot signature (0x29)
-            uint32_t BS_VolID;          // Volume serial number
-            uint8_t BS_VolLab[11];      // Volume label
-            uint8_t BS_FilSysType[8];   // Always set to the string "FAT32   "
-            uint8_t BS_bootCode[420];   // Bootstrap code
-        } fat32_ext;
-    };
-    uint16_t BS_signature;  // must be 0xAA55
-};
+static uint8_t log_2(uint32_t num) {
+    uint8_t ret = 0;
 
-/* FS Info - Only for FAT32 */
-struct __attribute__((packed)) FSInfo_s {
-    uint32_t FSI_LeadSig;       // Lead signature (must be 0x41615252 to indicate a valid FSInfo structure)
-    uint8_t FSI_Reserved1[480];
-    uint32_t FSI_StrucSig;      // Another signature (must be 0x61417272)
-    uint32_t FSI_Free_Count;    // Contains the last known free cluster count on the volume
-    uint32_t FSI_Nxt_Free;      // Indicates the cluster number at which the filesystem driver should start looking for available clusters
-    uint8_t FSI_Reserved2[12];
-    uint32_t FSI_TrailSig;      // Trail signature (0xAA550000)
-};
+    if (num) {
+        while (num != 1) {
+            num >>= 1;
+            ret++;
+        }
+    }
 
-struct __attribute__((packed)) FATDir_s {
-    uint8_t DIR_Name[11];       // Short name (8.3 format)
-    uint8_t DIR_Attr;           // File attributes:
-#define ATTR_READ_ONLY  0x01
-#define ATTR_HIDDEN     0x02
-#define ATTR_SYSTEM     0x04
-#define ATTR_VOLUME_ID  0x08
-#define ATTR_DIRECTORY  0x10
-#define ATTR_ARCHIVE    0x20
-#define ATTR_LONG_NAME (ATTR_READ_ONLY | ATTR_HIDDEN |  \
-                        ATTR_SYSTEM | ATTR_VOLUME_ID)
-    uint8_t DIR_NTRes;          // Reserved for use by Windows NT
-    uint8_t DIR_CrtTimeTenth;   // Millisecond stamp at file creation time
-    uint16_t DIR_CrtTime;       // Time file was created
-    uint16_t DIR_CrtDate;       // Date file was created
-    uint16_t DIR_LstAccDate;    // Last access date
-    uint16_t DIR_FstClusHI;     // High word of this entry’s first cluster number (always 0 for a FAT12 or FAT16 volume)
-    uint16_t DIR_WrtTime;       // Time of last write
-    uint16_t DIR_WrtDate;       // Date of last write
-    uint16_t DIR_FstClusLO;     // Low word of this entry’s first cluster number
-    uint32_t DIR_FileSize;      // 32-bit DWORD holding this file’s size in bytes
-};
+    return ret;
+}
 
-struct __attribute__((packed)) FATLDir_s {
-    uint8_t LDIR_Ord;           // The order of this entry in the sequence of long dir entries
-    uint16_t LDIR_Name1[5];     // Characters 1-5
-    uint8_t LDIR_Attr;          // Must be ATTR_LONG_NAME
-    uint8_t LDIR_Type;          // If zero, indicates a directory entry that is a sub-component of a long name
-    uint8_t LDIR_Chksum;        // Checksum of name in the short dir entry at the end of the long dir set
-    uint16_t LDIR_Name2[6];     // Characters 6-11
-    uint16_t LDIR_FstClusLO;    // Must be ZERO
-    uint16_t LDIR_Name3[2];     // Characters 12-13
-};
+/*!
+ * @brief Transfer sectors of one cluster with a single multi-block request.
+ *        Data goes directly between \p buf and the device.
+ * @param vol Volume
+ * @param clst Cluster number
+ * @param sect First sector inside the cluster
+ * @param cnt Number of sectors (up to the end of the cluster)
+ * @param buf Source or destination (\p cnt sectors)
+ * @param cmd REQ_READ or REQ_WRITE
+ * @return 0 on success
+ */
+int8_t fat_clust_io(fs_volume_t *vol, uint32_t clst, uint8_t sect,
+                    uint8_t cnt, void *buf, uint8_t cmd) {
+    fat_spec_t *fsp = vol->fs_spec;
+    req_t req;
+
+    if (((uint16_t)sect + cnt) > (1U << fsp->sec_per_clst_log))
+        // out of cluster
+        return -1;
+
+    req.bdev = vol->bdev;
+    req.cmd_flags = cmd;
+    req.block = get_sect_of_clust(clst, fsp) + sect;
+    req.blk_cnt = cnt;
+    req.buf = buf;
+    req.offset = 0;
+    req.count = 0;
+
+    if (cache_sync_range(req.bdev, req.block, cnt, cmd))
+        return -1;
+
+    return blk_request(&req);
+}
 
-typedef struct BPB_s bpb_t;
-typedef struct FSInfo_s fs_info_t;
-typedef struct FATDir_s dir_t;
-typedef struct FATLDir_s ldir_t;
+/*!
+ * @brief Read one directory entry without loading the whole sector
+ * @param vol Volume
+ * @param sect Sector with the entry
+ * @param idx Index of the entry in the sector
+ * @param ent Entry to fill
+ * @return 0 on success
+ */
+int8_t fat_read_dirent(fs_volume_t *vol, uint32_t sect, uint8_t idx,
+                       dir_t *ent) {
+    return cache_read_part(vol->bdev, sect, (uint16_t)idx * sizeof(dir_t),
+                           sizeof(dir_t), ent);
+}
 
-typedef union fat_cache {
-    bpb_t bpb;
-    fs_info_t fs_info;
-    dir_t dir[16];
-    uint32_t fat32[128];
-    uint16_t fat16[256];
-    uint8_t data[512];
-} fat_cache_t;
+/*!
+ * @brief Convert raw FAT entry value to the chain result
+ * @param val FAT entry value
+ * @param fsp FAT specified data
+ * @return Next cluster; CLST_EOC on end of chain; CLST_ERR on bad, free
+ *         or out of range entry
+ */
+static uint32_t fat_chain_val(uint32_t val, const fat_spec_t *fsp) {
+    if (val >= fsp->eoc)
+        return CLST_EOC;
+    if ((val < 2) || (val == fsp->bad) || (val >= fsp->tot_clusters + 2))
+        return CLST_ERR;
 
-struct fat_entry_ops {
+    return val;
+}
 
-};
+/* FAT sector window used while following a chain */
+typedef struct fat_win_s {
+    uint32_t (*get)(const fat_cache_t *, uint16_t);  // entry accessor
+    fat_cache_t *fat;   // loaded FAT sector; NULL if none
+    uint32_t sect;      // number of the loaded sector
+} fat_win_t;
+
+static void fat_win_init(fat_win_t *win, const fat_spec_t *fsp) {
+    win->get = pgm_read_ptr(&fsp->ent_ops->get);
+    win->fat = NULL;
+    win->sect = 0;
+}
 
-typedef struct fat_spec_data_s {
-    uint8_t bytes_per_sec_log;  // bytes per sector (log_2)
-    uint8_t sec_per_clst_log;   // sectros per cluster (log_2)
-    uint32_t tot_clusters;  // total clusters number
-    uint32_t sec_per_fat;   // sectors per FAT
-    uint8_t fat_number;     // number of FAT
-    uint32_t fat_sector;    // FAT sector
-    uint32_t root_sector;   // root sector
-    uint32_t data_sector;   // sector for cluster #2
-    uint8_t fat_type;       // FAT12, FAT16 or FAT32
-    const struct fat_entry_ops *ent_ops;
-} fat_spec_t;
+/*!
+ * @brief Get next cluster through the window.
+ *        A FAT sector is loaded only when the entry falls outside
+ *        the current one. No other cache calls may be made while
+ *        the window is in use.
+ * @param vol Volume
+ * @param win FAT sector window
+ * @param clst Cluster number
+ * @return Next cluster; CLST_EOC; CLST_ERR on error
+ */
+static uint32_t fat_win_next(fs_volume_t *vol, fat_win_t *win,
+                             uint32_t clst) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t sect;
+
+    if ((clst < 2) || (clst >= fsp->tot_clusters + 2))
+        return CLST_ERR;
+
+    sect = fsp->fat_sector + (clst >> fsp->ent_per_sec_log);
+    if (!win->fat || (sect != win->sect)) {
+        FS_STAT_ADD(vol, fat_load, 1);
+        win->fat = (fat_cache_t *)cache_get(vol->bdev, sect, CACHE_READ);
+        if (!win->fat)
+            return CLST_ERR;
+        win->sect = sect;
+    }
 
-static uint8_t log_2(uint32_t num) {
-    uint8_t ret = 0;
+    return fat_chain_val(win->get(win->fat,
+                                  clst & ((1U << fsp->ent_per_sec_log) - 1)),
+                         fsp);
+}
 
-    if (num) {
-        while (num != 1) {
-            num >>= 1;
-            ret++;
+/*!
+ * @brief Get next cluster in the chain
+ * @param vol Volume
+ * @param clst Cluster number
+ * @return Next cluster; CLST_EOC if \p clst is the last one; CLST_ERR on error
+ */
+uint32_t fat_next_clust(fs_volume_t *vol, uint32_t clst) {
+    return fat_walk(vol, clst, 1);
+}
+
+/*!
+ * @brief Follow the cluster chain.
+ *        Long chains cost one sector read per 128 (FAT32)
+ *        or 256 (FAT16) clusters.
+ * @param vol Volume
+ * @param clst Start cluster
+ * @param n Number of links to follow
+ * @return Cluster reached; CLST_EOC if the chain ends earlier;
+ *         CLST_ERR on error or if the chain is cyclic
+ */
+uint32_t fat_walk(fs_volume_t *vol, uint32_t clst, uint32_t n) {
+    fat_spec_t *fsp = vol->fs_spec;
+    fat_win_t win;
+
+    fat_win_init(&win, fsp);
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (i == fsp->tot_clusters)
+            // more links than clusters: the chain is cyclic
+            return CLST_ERR;
+        clst = fat_win_next(vol, &win, clst);
+        if ((clst == CLST_EOC) || (clst == CLST_ERR))
+            break;
+    }
+
+    return clst;
+}
+
+/*!
+ * @brief Build extent map of the cluster chain.
+ *        If the chain has more runs than the table can hold, the map
+ *        covers the beginning of the chain only.
+ * @param vol Volume
+ * @param start First cluster of the chain
+ * @param map Map with caller-supplied table (\a ext and \a size)
+ * @return 0 on success
+ */
+int8_t fat_extmap_build(fs_volume_t *vol, uint32_t start,
+                        fs_extmap_t *map) {
+    fat_spec_t *fsp = vol->fs_spec;
+    fs_extent_t *ext = map->ext;
+    fat_win_t win;
+    uint32_t clst = start;
+    uint32_t next;
+
+    map->runs = 0;
+    map->clusters = 0;
+    map->complete = 0;
+
+    if (!map->size)
+        return -1;
+
+    fat_win_init(&win, fsp);
+
+    ext->clst = start;
+    ext->fcl = 0;
+    map->runs = 1;
+
+    while (1) {
+        if (++map->clusters > fsp->tot_clusters)
+            // cyclic chain
+            return -1;
+        next = fat_win_next(vol, &win, clst);
+        if (next == CLST_EOC)
+            break;
+        if (next == CLST_ERR)
+            return -1;
+
+        if (next != clst + 1) {
+            // new run
+            if (map->runs == map->size)
+                // table is full; the rest is reached by walking the chain
+                return 0;
+            ext++;
+            ext->clst = next;
+            ext->fcl = map->clusters;
+            map->runs++;
         }
+        clst = next;
     }
 
-    return ret;
+    map->complete = 1;
+
+    return 0;
 }
 
 /*!
- * @brief
- * @param clst Cluster number (must be greater or equal to 2)
- * @param fsp FAT specified data
- * @return Sector number of \p cluster
+ * @brief Get cluster by its index in the file
+ * @param vol Volume
+ * @param map Extent map built by fat_extmap_build()
+ * @param idx Cluster index in the file
+ * @return Cluster number; CLST_EOC if the file is shorter; CLST_ERR on error
  */
-static uint32_t get_sect_of_clust(uint32_t clst, fat_spec_t *fsp) {
-    return ((clst - 2) << fsp->sec_per_clst_log) + fsp->data_sector;
+uint32_t fat_extmap_clust(fs_volume_t *vol, const fs_extmap_t *map,
+                          uint32_t idx) {
+    const fs_extent_t *ext = map->ext;
+    uint16_t lo = 0;
+    uint16_t hi;
+    uint32_t last;
+
+    if (!map->runs)
+        return CLST_ERR;
+
+    if (idx >= map->clusters) {
+        if (map->complete)
+            return CLST_EOC;
+        // continue from the last mapped cluster
+        ext += map->runs - 1;
+        last = ext->clst + (map->clusters - 1 - ext->fcl);
+        return fat_walk(vol, last, idx - (map->clusters - 1));
+    }
+
+    // the last run starting at or before idx
+    hi = map->runs - 1;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi + 1) >> 1;
+
+        if (ext[mid].fcl <= idx)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return ext[lo].clst + (idx - ext[lo].fcl);
 }
 
 /*
@@ -180,22 +279,52 @@ static void dump_sector(uint8_t *buf) {
 }   // */
 
 const struct vol_ops fat_ops PROGMEM = {
-    .create = NULL,
-    .lookup = NULL,
+    .create = fat_create,
+    .lookup = fat_lookup,
     .mkdir = NULL,
     .rmdir = NULL,
     .rename = NULL,
     .setattr = NULL,
-    .getattr = NULL,
+    .getattr = fat_getattr,
     .update_time = NULL,
+    .unlink = fat_unlink,
+    .readdir = fat_readdir,
+    .rewinddir = fat_dir_rewind,
+    .open = fat_open,
+    .read = fat_read,
+    .write = fat_write,
+    .lseek = fat_lseek,
+    .fupdate = fat_fupdate,
+    .syncfs = fat_sync,
+    .prealloc = fat_fprealloc,
+    .release = fat_release,
 };
 
-const struct fat_entry_ops fat16_ops PROGMEM = {
+static uint32_t fat16_get(const fat_cache_t *fat, uint16_t idx) {
+    return fat->fat16[idx];
+}
 
+static void fat16_set(fat_cache_t *fat, uint16_t idx, uint32_t val) {
+    fat->fat16[idx] = (uint16_t)val;
+}
+
+static uint32_t fat32_get(const fat_cache_t *fat, uint16_t idx) {
+    return fat->fat32[idx] & 0x0FFFFFFF;
+}
+
+static void fat32_set(fat_cache_t *fat, uint16_t idx, uint32_t val) {
+    // upper 4 bits are reserved and must be kept
+    fat->fat32[idx] = (fat->fat32[idx] & 0xF0000000) | (val & 0x0FFFFFFF);
+}
+
+const struct fat_entry_ops fat16_ops PROGMEM = {
+    .get = fat16_get,
+    .set = fat16_set,
 };
 
 const struct fat_entry_ops fat32_ops PROGMEM = {
-
+    .get = fat32_get,
+    .set = fat32_set,
 };
 
 /*
@@ -206,16 +335,86 @@ const struct fat_entry_ops exfat_ops PROGMEM = {
 */
 
 /*!
- * @brief Initialize FAT file system
+ * @brief Set entry format of the FAT type
+ * @param fsp FAT specified data with \a fat_type set
+ * @return 0 on success; -1 if the type is not supported
+ */
+static int8_t fat_set_type(fat_spec_t *fsp) {
+    switch (fsp->fat_type) {
+        case FAT16:
+            fsp->ent_per_sec_log = fsp->bytes_per_sec_log - 1;
+            fsp->eoc = FAT16_EOC;
+            fsp->bad = FAT16_BAD;
+            fsp->ent_ops = &fat16_ops;
+            return 0;
+
+        case FAT32:
+            fsp->ent_per_sec_log = fsp->bytes_per_sec_log - 2;
+            fsp->eoc = FAT32_EOC;
+            fsp->bad = FAT32_BAD;
+            fsp->ent_ops = &fat32_ops;
+            return 0;
+
+        default:
+            // FAT12 and exFAT are not supported yet
+            // fsp->ent_ops = &fat12_ops;
+            // fsp->ent_ops = &exfat_ops;
+            return -1;
+    }
+}
+
+/*!
+ * @brief Finish mount from the volume geometry: allocation units,
+ *        volume operations and root directory
+ * @param vol Volume with fs_spec and root.clust set
+ */
+static void fat_setup(fs_volume_t *vol) {
+    fat_spec_t *fat_spec = vol->fs_spec;
+    uint32_t au;
+    uint32_t au_off;
+    uint32_t spc;
+
+    // clusters are aligned to allocation units of the device if the data
+    // area (vol->start_sector included) is shifted by whole clusters
+    au = vol->bdev->bd_au_size;
+    spc = 1UL << fat_spec->sec_per_clst_log;
+    au_off = au ? get_sect_of_clust(2, fat_spec) % au : 0;
+    fat_spec->au_clst = 0;
+    fat_spec->au_first = 0;
+    if (au && !(au % spc) && !((au - au_off) % spc)) {
+        fat_spec->au_clst = au / spc;
+        fat_spec->au_first = 2 + ((au - au_off) % au) / spc;
+    }
+
+    fat_spec->discard_cnt = 0;
+#if FS_FAT_MIRROR_RUNS
+    fat_spec->mirror_cnt = 0;
+#endif  /* FS_FAT_MIRROR_RUNS */
+
+    vol->v_ops = &fat_ops;
+
+    // setting of root directory
+    vol->root.vol = vol;
+    vol->root.sect = fat_spec->root_sector;
+    vol->root.offset = 0;
+    vol->root.entry = NULL;
+    vol->root.ent_size = 32;
+    vol->root.ent_sect = 0;
+    vol->root.ent_idx = 0;
+    vol->root.type = DT_DIR;
+}
+
+/*!
+ * @brief Initialize FAT file system.
+ *        With FS_FAT_MSTATE the geometry and free space are taken from
+ *        the saved mount state if it matches the boot sector.
  * @param vol Pointer to volume structure
- * @param req Pointer to request structure
  * @return 0 on success
  */
-int8_t fat_init(fs_volume_t *vol, req_t *req) {
+int8_t fat_init(fs_volume_t *vol) {
     fat_spec_t *fat_spec;
     fat_cache_t *cache;
-    req_f req_func;
-    int8_t ret = -1;
+    int8_t ret = 0;
 
     uint8_t root_dir_sectors;
 
@@ -223,18 +422,25 @@ int8_t fat_init(fs_volume_t *vol, req_t *req) {
 
     if (!fat_spec)
         // ENOMEM
-        return ret;
+        return -1;
 
     vol->fs_spec = fat_spec;
 
-    cache = req->buf;
-    req_func = pgm_read_ptr(&vol->bdev->blk_ops->request);
-    req->block = vol->start_sector;
-
-    ret = req_func(req);
-    if (ret)
+    cache = (fat_cache_t *)cache_get(vol->bdev, vol->start_sector, CACHE_READ);
+    if (!cache) {
         // some err
-        return ret;
+        free(fat_spec);
+        return -1;
+    }
+
+#if FS_FAT_MSTATE
+    if (!fat_mstate_load(vol, &cache->bpb) && !fat_set_type(fat_spec)) {
+        // boot sector and FSInfo are the only ones read
+        fat_mstate_verify(vol);
+        fat_setup(vol);
+        return 0;
+    }
+#endif  /* FS_FAT_MSTATE */
 
     fat_spec->bytes_per_sec_log = log_2(cache->bpb.BPB_BytsPerSec);
     fat_spec->sec_per_clst_log = log_2(cache->bpb.BPB_SecPerClus);
@@ -260,50 +466,97 @@ int8_t fat_init(fs_volume_t *vol, req_t *req) {
                                   root_dir_sectors);
         fat_spec->tot_clusters = data_sects >> fat_spec->sec_per_clst_log;
 
-        if (fat_spec->tot_clusters < 4085) {
-            fat_spec->fat_type = FAT12; // not supported yet
-            // fat_spec->ent_ops = &fat12_ops;
-            free(fat_spec);
-            return -1;
-        } else if (fat_spec->tot_clusters < 65525) {
+        if (fat_spec->tot_clusters < 4085)
+            fat_spec->fat_type = FAT12;
+        else if (fat_spec->tot_clusters < 65525)
             fat_spec->fat_type = FAT16;
-            fat_spec->ent_ops = &fat16_ops;
-        } else if (fat_spec->tot_clusters < 268435445) {
+        else if (fat_spec->tot_clusters < 268435445)
             fat_spec->fat_type = FAT32;
-            fat_spec->ent_ops = &fat32_ops;
-        } else {
-            fat_spec->fat_type = FAT64; // not supported yet
-            // fat_spec->ent_ops = &exfat_ops;
+        else
+            fat_spec->fat_type = FAT64;
+
+        if (fat_set_type(fat_spec)) {
             free(fat_spec);
             return -1;
         }
     }
 
     fat_spec->data_sector = fat_spec->fat_sector + (fat_spec->sec_per_fat * fat_spec->fat_number);
+    fat_spec->fsi_sector = 0;
+    fat_spec->flags = 0;
 
     switch (fat_spec->fat_type) {
         case FAT12:
         case FAT16:
             fat_spec->root_sector = fat_spec->data_sector;
             fat_spec->data_sector = fat_spec->root_sector + root_dir_sectors;
-            vol->root.clust = 2;
+            vol->root.clust = 0;    // fixed root, not a cluster
+#if FS_FAT_MSTATE
+            fat_spec->vol_id = cache->bpb.fat12_16_ext.BS_VolID;
+#endif  /* FS_FAT_MSTATE */
             break;
 
         case FAT32:
             fat_spec->root_sector = get_sect_of_clust(cache->bpb.fat32_ext.BPB_RootClus, fat_spec);
             vol->root.clust = cache->bpb.fat32_ext.BPB_RootClus;
+            if (cache->bpb.fat32_ext.BPB_FSInfo)
+                fat_spec->fsi_sector = vol->start_sector +
+                                       cache->bpb.fat32_ext.BPB_FSInfo;
+            if (cache->bpb.fat32_ext.BPB_ExtFlags & EXT_NO_MIRROR) {
+                // only the active FAT is read and written
+                uint8_t act = cache->bpb.fat32_ext.BPB_ExtFlags &
+                              EXT_ACTIVE_FAT;
+
+                if (act < fat_spec->fat_number)
+                    fat_spec->fat_sector += act * fat_spec->sec_per_fat;
+                fat_spec->flags |= FAT_F_NO_MIRROR;
+            }
+#if FS_FAT_MSTATE
+            fat_spec->vol_id = cache->bpb.fat32_ext.BS_VolID;
+#endif  /* FS_FAT_MSTATE */
             break;
 
         default:    // unreachable
             break;
     }
 
-    // setting of root directory
-    vol->root.vol = vol;
-    vol->root.sect = fat_spec->root_sector;
-    vol->root.offset = 0;
-    vol->root.entry = NULL;
-    vol->root.ent_size = 32;
+    fat_setup(vol);
+
+    // BPB is not used anymore
+    fat_load_fsinfo(vol);
+
+#if FS_FAT_MSTATE
+    // next mount can skip all of the above
+    fat_mstate_store(vol);
+#endif  /* FS_FAT_MSTATE */
 
     return ret;
 }
+
+/*!
+ * @brief Add clusters appended to the chain to its map.
+ *        A map that covers the beginning of the chain only stays as is.
+ * @param map Extent map
+ * @param clst First appended cluster
+ * @param cnt Number of consecutive clusters appended
+ */
+void fat_extmap_append(fs_extmap_t *map, uint32_t clst, uint32_t cnt) {
+    fs_extent_t *last;
+
+    if (!map->runs || !map->complete)
+        return;
+
+    last = map->ext + map->runs - 1;
+    if (clst != last->clst + (map->clusters - last->fcl)) {
+        // new run
+        if (map->runs == map->size) {
+            map->complete = 0;
+            return;
+        }
+        last++;
+        last->clst = clst;
+        last->fcl = map->clusters;
+        map->runs++;
+    }
+    map->clusters += cnt;
+}
@@ -0,0 +1,328 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include <stdint.h>
+
+#include "fs.h"
+
+#ifndef FS_FAT_MIRROR_RUNS
+#define FS_FAT_MIRROR_RUNS 0    // runs of changed FAT sectors to remember; if
+                                // set, only the first FAT is updated and the
+                                // other copies are brought up to date by
+                                // fat_sync(). 0 - all copies are updated at once
+#endif  /* !FS_FAT_MIRROR_RUNS */
+
+#ifndef FS_FAT_DISCARD_RUNS
+#define FS_FAT_DISCARD_RUNS 4   // runs of freed clusters to discard once the
+                                // FAT is written; a longer fragmented chain
+                                // writes the cache back while it is freed
+#endif  /* !FS_FAT_DISCARD_RUNS */
+
+#if FS_FAT_DISCARD_RUNS < 1
+#error "FS_FAT_DISCARD_RUNS must be at least 1"
+#endif
+
+#ifndef FS_FAT_MSTATE
+#define FS_FAT_MSTATE 0         // 1 - keep mount state of volumes in the slot
+                                // set by fat_mstate_set_slot()
+#endif  /* !FS_FAT_MSTATE */
+
+/* FAT types */
+#define FAT12 0 // FAT12
+#define FAT16 1 // FAT16
+#define FAT32 2 // FAT32
+#define FAT64 3 // exFAT
+
+/* EOC */
+#define FAT12_EOC 0x0FF8
+#define FAT16_EOC 0xFFF8
+#define FAT32_EOC 0x0FFFFFF8
+
+/* Bad cluster value */
+#define FAT12_BAD 0x0FF7
+#define FAT16_BAD 0xFFF7
+#define FAT32_BAD 0x0FFFFFF7
+
+/* FSInfo */
+#define FSI_LEAD_SIG    0x41615252
+#define FSI_STRUC_SIG   0x61417272
+#define FSI_TRAIL_SIG   0xAA550000
+#define FAT_FREE_UNKNOWN 0xFFFFFFFF // free clusters number is not known
+
+struct __attribute__((packed)) BPB_s {
+    uint8_t BS_jmpBoot[3];      // Jump instruction to boot code
+    uint8_t BS_OEMName[8];      // Name string (e.g. "MSWIN4.1")
+    uint16_t BPB_BytsPerSec;    // Count of bytes per sector
+    uint8_t BPB_SecPerClus;     // Number of sectors per allocation unit
+    uint16_t BPB_RsvdSecCnt;    // Number of reserved sectors in the Reserved region of the volume starting at the first sector of the volume. This field must not be 0. 
+    uint8_t BPB_NumFATs;        // The count of FAT data structures on the volume
+    uint16_t BPB_RootEntCnt;    // For FAT12 and FAT16, this field contains the count of 32-byte directory entries in the root directory. For FAT32, this field must be set to 0
+    uint16_t BPB_TotSec16;      // This field is the old 16-bit total count of sectors on the volume
+    uint8_t BPB_Media;          // 0xF8 is the standard value for “fixed” (non-removable) media
+    uint16_t BPB_FATSz16;       // This field is the FAT12/FAT16 16-bit count of sectors occupied by ONE FAT. On FAT32 this field must be 0, and BPB_FATSz32 contains the FAT size count
+    uint16_t BPB_SecPerTrk;     // Sectors per track for interrupt 0x13
+    uint16_t BPB_NumHeads;      // Number of heads for interrupt 0x13
+    uint32_t BPB_HiddSec;       // Count of hidden sectors preceding the partition that contains this FAT volume
+    uint32_t BPB_TotSec32;      // This field is the new 32-bit total count of sectors on the volume
+
+    union {
+        struct __attribute__((packed)) {
+            uint8_t BS_DrvNum;          // Int 0x13 drive number (e.g. 0x80)
+            uint8_t BS_Reserved1;       // Reserved (used by Windows NT)
+            uint8_t BS_BootSig;         // Extended boot signature (0x29)
+            uint32_t BS_VolID;          // Volume serial number
+            uint8_t BS_VolLab[11];      // Volume label
+            uint8_t BS_FilSysType[8];   // One of the strings "FAT12   ", "FAT16   ", or "FAT     "
+            uint8_t BS_bootCode[448];   // Bootstrap code
+        } fat12_16_ext;
+        struct __attribute__((packed)) {
+            uint32_t BPB_FATSz32;       // Count of sectors occupied by ONE FAT. BPB_FATSz16 must be 0
+            uint16_t BPB_ExtFlags;      // Flags
+#define EXT_ACTIVE_FAT  0x000F  // Number of active FAT (if mirroring is off)
+#define EXT_NO_MIRROR   0x0080  // FAT is not mirrored at runtime
+            uint16_t BPB_FSVer;         // Version number of the FAT32 volume (maj.min)
+            uint32_t BPB_RootClus;      // This is set to the cluster number of the first cluster of the root directory, usually 2 but not required to be 2
+            uint16_t BPB_FSInfo;        // Sector number of FSINFO structure in the reserved area. Usually 1
+            uint16_t BPB_BkBootSec;     // If non-zero, indicates the sector number in the reserved area of the volume of a copy of the boot record. Usually 6. No value other than 6 is recommended.
+            uint8_t BPB_Reserved[12];   // Reserved for future expansion
+            uint8_t BS_DrvNum;          // Int 0x13 drive number (e.g. 0x80)
+            uint8_t BS_Reserved1;       // Reserved (used by Windows NT)
+            uint8_t BS_BootSig;         // Extended boot signature (0x29)
+            uint32_t BS_VolID;          // Volume serial number
+            uint8_t BS_VolLab[11];      // Volume label
+            uint8_t BS_FilSysType[8];   // Always set to the string "FAT32   "
+            uint8_t BS_bootCode[420];   // Bootstrap code
+        } fat32_ext;
+    };
+    uint16_t BS_signature;  // must be 0xAA55
+};
+
+/* FS Info - Only for FAT32 */
+struct __attribute__((packed)) FSInfo_s {
+    uint32_t FSI_LeadSig;       // Lead signature (must be 0x41615252 to indicate a valid FSInfo structure)
+    uint8_t FSI_Reserved1[480];
+    uint32_t FSI_StrucSig;      // Another signature (must be 0x61417272)
+    uint32_t FSI_Free_Count;    // Contains the last known free cluster count on the volume
+    uint32_t FSI_Nxt_Free;      // Indicates the cluster number at which the filesystem driver should start looking for available clusters
+    uint8_t FSI_Reserved2[12];
+    uint32_t FSI_TrailSig;      // Trail signature (0xAA550000)
+};
+
+struct __attribute__((packed)) FATDir_s {
+    uint8_t DIR_Name[11];       // Short name (8.3 format)
+    uint8_t DIR_Attr;           // File attributes:
+#define ATTR_READ_ONLY  0x01
+#define ATTR_HIDDEN     0x02
+#define ATTR_SYSTEM     0x04
+#define ATTR_VOLUME_ID  0x08
+#define ATTR_DIRECTORY  0x10
+#define ATTR_ARCHIVE    0x20
+#define ATTR_LONG_NAME (ATTR_READ_ONLY | ATTR_HIDDEN |  \
+                        ATTR_SYSTEM | ATTR_VOLUME_ID)
+    uint8_t DIR_NTRes;          // Reserved for use by Windows NT
+    uint8_t DIR_CrtTimeTenth;   // Millisecond stamp at file creation time
+    uint16_t DIR_CrtTime;       // Time file was created
+    uint16_t DIR_CrtDate;       // Date file was created
+    uint16_t DIR_LstAccDate;    // Last access date
+    uint16_t DIR_FstClusHI;     // High word of this entry’s first cluster number (always 0 for a FAT12 or FAT16 volume)
+    uint16_t DIR_WrtTime;       // Time of last write
+    uint16_t DIR_WrtDate;       // Date of last write
+    uint16_t DIR_FstClusLO;     // Low word of this entry’s first cluster number
+    uint32_t DIR_FileSize;      // 32-bit DWORD holding this file’s size in bytes
+};
+
+struct __attribute__((packed)) FATLDir_s {
+    uint8_t LDIR_Ord;           // The order of this entry in the sequence of long dir entries
+#define LAST_LONG_ENTRY 0x40    // Mask of the last entry of the sequence
+    uint16_t LDIR_Name1[5];     // Characters 1-5
+    uint8_t LDIR_Attr;          // Must be ATTR_LONG_NAME
+    uint8_t LDIR_Type;          // If zero, indicates a directory entry that is a sub-component of a long name
+    uint8_t LDIR_Chksum;        // Checksum of name in the short dir entry at the end of the long dir set
+    uint16_t LDIR_Name2[6];     // Characters 6-11
+    uint16_t LDIR_FstClusLO;    // Must be ZERO
+    uint16_t LDIR_Name3[2];     // Characters 12-13
+};
+
+typedef struct BPB_s bpb_t;
+typedef struct FSInfo_s fs_info_t;
+typedef struct FATDir_s dir_t;
+typedef struct FATLDir_s ldir_t;
+
+#define FAT_DIR_PER_SECT 16 // directory entries per sector
+
+typedef union fat_cache {
+    bpb_t bpb;
+    fs_info_t fs_info;
+    dir_t dir[16];
+    uint32_t fat32[128];
+    uint16_t fat16[256];
+    uint8_t data[512];
+} fat_cache_t;
+
+struct fat_entry_ops {
+    uint32_t (*get)(const fat_cache_t *fat, uint16_t idx);  // get entry from FAT sector
+    void (*set)(fat_cache_t *fat, uint16_t idx, uint32_t val);  // set entry in FAT sector
+};
+
+typedef struct fat_spec_data_s {
+    uint8_t bytes_per_sec_log;  // bytes per sector (log_2)
+    uint8_t sec_per_clst_log;   // sectros per cluster (log_2)
+    uint32_t tot_clusters;  // total clusters number
+    uint32_t sec_per_fat;   // sectors per FAT
+    uint8_t fat_number;     // number of FAT
+    uint32_t fat_sector;    // FAT sector
+    uint32_t root_sector;   // root sector
+    uint32_t data_sector;   // sector for cluster #2
+    uint8_t fat_type;       // FAT12, FAT16 or FAT32
+    uint8_t ent_per_sec_log;    // FAT entries per sector (log_2)
+    uint32_t eoc;           // EOC value of this FAT type
+    uint32_t bad;           // bad cluster value of this FAT type
+    uint32_t free_clst;     // free clusters number (FAT_FREE_UNKNOWN if not known)
+    uint32_t next_free;     // cluster to start searching for free ones from
+    uint32_t fsi_sector;    // FSInfo sector; 0 if none
+    uint8_t flags;          // FAT_F_*
+#define FAT_F_FSI_DIRTY 0x01    // free_clst/next_free must be written to FSInfo
+#define FAT_F_NO_MIRROR 0x02    // FAT32 mirroring is off: only active FAT is used
+#define FAT_F_NO_FREE_AU 0x04   // no AU starts with a free cluster since
+                                // last search; cleared on free
+    const struct fat_entry_ops *ent_ops;
+    uint32_t au_clst;       // clusters per allocation unit of the device;
+                            // 0 - allocation is not aligned
+    uint32_t au_first;      // first cluster at the AU boundary
+#if FS_FAT_MSTATE
+    uint32_t vol_id;        // volume serial number (BS_VolID)
+#endif  /* FS_FAT_MSTATE */
+    uint8_t discard_cnt;    // number of runs in discard
+    struct {
+        uint32_t first;     // first cluster
+        uint32_t cnt;       // number of clusters
+    } discard[FS_FAT_DISCARD_RUNS]; // freed clusters to discard after
+                                    // the FAT is on the device
+#if FS_FAT_MIRROR_RUNS
+    uint8_t mirror_cnt;     // number of runs in mirror
+    struct {
+        uint32_t first;     // first sector from the start of FAT
+        uint32_t last;      // last sector from the start of FAT
+    } mirror[FS_FAT_MIRROR_RUNS];   // FAT sectors to copy to mirrors
+#endif  /* FS_FAT_MIRROR_RUNS */
+} fat_spec_t;
+
+#if FS_FAT_MSTATE
+#define FAT_MSTATE_VER 2    // version of the fat_mstate_t layout
+
+/* Mount state of a volume kept in non-volatile memory */
+typedef struct __attribute__((packed)) fat_mstate_s {
+    uint8_t version;        // FAT_MSTATE_VER
+    uint32_t vol_id;        // BS_VolID of the volume
+    uint32_t start_sector;  // first sector of the volume
+    uint8_t bytes_per_sec_log;
+    uint8_t sec_per_clst_log;
+    uint8_t fat_number;
+    uint8_t fat_type;
+    uint8_t flags;          // FAT_F_NO_MIRROR, FAT_MS_CLEAN
+#define FAT_MS_CLEAN 0x80       // free_clst/next_free match FSInfo on the device
+    uint32_t tot_clusters;
+    uint32_t sec_per_fat;
+    uint32_t fat_sector;
+    uint32_t root_sector;
+    uint32_t data_sector;
+    uint32_t fsi_sector;
+    uint32_t root_clust;    // first cluster of FAT32 root; 0 - fixed root
+    uint32_t free_clst;
+    uint32_t next_free;
+    uint16_t chksum;        // Fletcher-16 of the fields above
+} fat_mstate_t;
+
+/*!
+ * Slot functions get the volume (vol->start_sector tells partitions of
+ * the drive apart) and return 0 on success
+ */
+typedef int8_t (*fat_mstate_load_f)(const fs_volume_t *vol, void *buf,
+                                    uint8_t size, void *arg);
+typedef int8_t (*fat_mstate_store_f)(const fs_volume_t *vol,
+                                     const void *buf, uint8_t size,
+                                     void *arg);
+#endif  /* FS_FAT_MSTATE */
+
+/* Results of the FAT chain functions */
+#define CLST_ERR 0              // error: I/O, bad or free cluster in chain
+#define CLST_EOC 0xFFFFFFFF     // end of chain
+
+/*!
+ * @brief
+ * @param clst Cluster number (must be greater or equal to 2)
+ * @param fsp FAT specified data
+ * @return Sector number of \p cluster
+ */
+static inline uint32_t get_sect_of_clust(uint32_t clst, fat_spec_t *fsp) {
+    return ((clst - 2) << fsp->sec_per_clst_log) + fsp->data_sector;
+}
+
+int8_t fat_clust_io(fs_volume_t *vol, uint32_t clst, uint8_t sect,
+                    uint8_t cnt, void *buf, uint8_t cmd);
+int8_t fat_read_dirent(fs_volume_t *vol, uint32_t sect, uint8_t idx,
+                       dir_t *ent);
+uint32_t fat_next_clust(fs_volume_t *vol, uint32_t clst);
+uint32_t fat_walk(fs_volume_t *vol, uint32_t clst, uint32_t n);
+int8_t fat_extmap_build(fs_volume_t *vol, uint32_t start,
+                        fs_extmap_t *map);
+uint32_t fat_extmap_clust(fs_volume_t *vol, const fs_extmap_t *map,
+                          uint32_t idx);
+void fat_extmap_append(fs_extmap_t *map, uint32_t clst, uint32_t cnt);
+
+#define LFN_CHARS_PER_ENT 13  // UTF-16 chars in one long name entry
+#define LFN_MAX_ENT 20          // long name entries for 255 chars
+
+/* Long name being collected while reading a directory */
+typedef struct fat_lfn_s {
+    uint8_t ord;        // ordinal of the expected entry; 0 - complete;
+                        // LFN_NONE - no sequence
+#define LFN_NONE 0xFF
+    uint8_t chksum;     // checksum of the sequence
+    char *buf;          // buffer for the name (UTF-8); NULL - don't decode
+    uint16_t size;      // size of buf
+    uint16_t pos;       // start of the decoded part (decoded from the end)
+} fat_lfn_t;
+
+/* fat_dir.c */
+void fat_dir_rewind(DIR *dir);
+int8_t fat_dir_next_sect(DIR *dir);
+uint8_t fat_sfn_chksum(const uint8_t *sfn);
+void fat_lfn_reset(fat_lfn_t *lfn);
+void fat_lfn_feed(fat_lfn_t *lfn, const ldir_t *ent);
+uint8_t fat_lfn_done(fat_lfn_t *lfn, const dir_t *ent);
+int8_t fat_lookup(DIR *dir, const fs_name_t *name);
+int8_t fat_readdir(DIR *dir, struct dirent *ent);
+int8_t fat_getattr(DIR *dir, struct stat *st);
+uint32_t fat_time_now(void);
+int8_t fat_create(DIR *dir, const fs_name_t *name);
+int8_t fat_unlink(DIR *dir);
+
+/* fat_file.c */
+int8_t fat_open(file_t *file, const DIR *dir, uint8_t oflag);
+int16_t fat_read(file_t *file, void *buf, uint16_t count);
+int16_t fat_write(file_t *file, const void *buf, uint16_t count);
+int8_t fat_lseek(file_t *file, uint32_t pos);
+int8_t fat_fupdate(file_t *file);
+int8_t fat_fprealloc(file_t *file, uint32_t size);
+int8_t fat_release(file_t *file);
+
+/* fat_alloc.c */
+void fat_load_fsinfo(fs_volume_t *vol);
+int8_t fat_set_entry(fs_volume_t *vol, uint32_t clst, uint32_t val);
+uint32_t fat_alloc_clust(fs_volume_t *vol, uint32_t prev);
+uint32_t fat_alloc_contig(fs_volume_t *vol, uint32_t prev, uint32_t cnt);
+uint32_t fat_prealloc(fs_volume_t *vol, uint32_t prev, uint32_t size);
+int8_t fat_free_chain(fs_volume_t *vol, uint32_t clst);
+int8_t fat_sync(fs_volume_t *vol);
+
+#if FS_FAT_MSTATE
+/* fat_mstate.c */
+void fat_mstate_set_slot(fat_mstate_load_f load, fat_mstate_store_f store,
+                         void *arg);
+int8_t fat_mstate_load(fs_volume_t *vol, const bpb_t *bpb);
+void fat_mstate_verify(fs_volume_t *vol);
+void fat_mstate_store(const fs_volume_t *vol);
+#endif  /* FS_FAT_MSTATE */
+
+#endif  /* !FAT_H */
@@ -0,0 +1,695 @@
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "fs.h"
+#include "fat.h"
+#include "cache.h"
+
+/*!
+ * @brief Load free clusters number and next free hint from FSInfo.
+ *        Without valid FSInfo the count is unknown and search starts
+ *        from cluster #2.
+ * @param vol Volume
+ */
+void fat_load_fsinfo(fs_volume_t *vol) {
+    fat_spec_t *fsp = vol->fs_spec;
+    fat_cache_t *cache;
+
+    fsp->free_clst = FAT_FREE_UNKNOWN;
+    fsp->next_free = 2;
+
+    if (!fsp->fsi_sector)
+        return;
+
+    cache = (fat_cache_t *)cache_get(vol->bdev, fsp->fsi_sector, CACHE_READ);
+    if (!cache || (cache->fs_info.FSI_LeadSig != FSI_LEAD_SIG) ||
+        (cache->fs_info.FSI_StrucSig != FSI_STRUC_SIG) ||
+        (cache->fs_info.FSI_TrailSig != FSI_TRAIL_SIG)) {
+        // not valid FSInfo
+        fsp->fsi_sector = 0;
+        return;
+    }
+
+    if (cache->fs_info.FSI_Free_Count <= fsp->tot_clusters)
+        fsp->free_clst = cache->fs_info.FSI_Free_Count;
+    if ((cache->fs_info.FSI_Nxt_Free >= 2) &&
+        (cache->fs_info.FSI_Nxt_Free < fsp->tot_clusters + 2))
+        fsp->next_free = cache->fs_info.FSI_Nxt_Free;
+}
+
+/*!
+ * @brief Note that free clusters count or next free hint has changed.
+ *        On the first change after sync the saved mount state is marked
+ *        not clean, so the count is not trusted if power is lost before
+ *        the next sync.
+ * @param vol Volume
+ */
+static void fat_fsi_dirty(fs_volume_t *vol) {
+    fat_spec_t *fsp = vol->fs_spec;
+
+    if (fsp->flags & FAT_F_FSI_DIRTY)
+        return;
+    fsp->flags |= FAT_F_FSI_DIRTY;
+#if FS_FAT_MSTATE
+    fat_mstate_store(vol);
+#endif  /* FS_FAT_MSTATE */
+}
+
+/*!
+ * @brief Get number of FAT copies updated on every change
+ * @param fsp FAT specified data
+ * @return Number of copies from the first (active) one
+ */
+static uint8_t fat_copies(const fat_spec_t *fsp) {
+#if FS_FAT_MIRROR_RUNS
+    // mirrors are updated by fat_sync()
+    (void)fsp;
+    return 1;
+#else
+    return (fsp->flags & FAT_F_NO_MIRROR) ? 1 : fsp->fat_number;
+#endif  /* FS_FAT_MIRROR_RUNS */
+}
+
+/*!
+ * @brief Note that FAT sector has changed and must be copied to mirrors.
+ *        The sector extends a run it adjoins; when the table is full,
+ *        the nearest run is extended up to it.
+ * @param fsp FAT specified data
+ * @param sect Sector number from the start of FAT
+ */
+static void fat_mirror_mark(fat_spec_t *fsp, uint32_t sect) {
+#if FS_FAT_MIRROR_RUNS
+    uint32_t best = UINT32_MAX;
+    uint32_t dist;
+    uint8_t near = 0;
+
+    for (uint8_t i = 0; i < fsp->mirror_cnt; i++) {
+        if (sect + 1 < fsp->mirror[i].first)
+            dist = fsp->mirror[i].first - sect;
+        else if (sect > fsp->mirror[i].last + 1)
+            dist = sect - fsp->mirror[i].last;
+        else
+            dist = 0;
+
+        if (dist < best) {
+            best = dist;
+            near = i;
+        }
+    }
+
+    if (best && (fsp->mirror_cnt < FS_FAT_MIRROR_RUNS)) {
+        // new run
+        near = fsp->mirror_cnt++;
+        fsp->mirror[near].first = sect;
+        fsp->mirror[near].last = sect;
+        return;
+    }
+
+    if (sect < fsp->mirror[near].first)
+        fsp->mirror[near].first = sect;
+    if (sect > fsp->mirror[near].last)
+        fsp->mirror[near].last = sect;
+#else
+    (void)fsp;
+    (void)sect;
+#endif  /* FS_FAT_MIRROR_RUNS */
+}
+
+/*!
+ * @brief Set FAT entry in every FAT copy
+ * @param vol Volume
+ * @param clst Cluster number
+ * @param val New value of the entry
+ * @return 0 on success
+ */
+int8_t fat_set_entry(fs_volume_t *vol, uint32_t clst, uint32_t val) {
+    fat_spec_t *fsp = vol->fs_spec;
+    void (*set)(fat_cache_t *, uint16_t, uint32_t);
+    fat_cache_t *fat;
+    uint32_t sect;
+
+    if ((clst < 2) || (clst >= fsp->tot_clusters + 2))
+        return -1;
+
+    set = pgm_read_ptr(&fsp->ent_ops->set);
+    fat_mirror_mark(fsp, clst >> fsp->ent_per_sec_log);
+    sect = fsp->fat_sector + (clst >> fsp->ent_per_sec_log);
+
+    for (uint8_t i = 0; i < fat_copies(fsp); i++, sect += fsp->sec_per_fat) {
+        FS_STAT_ADD(vol, fat_load, 1);
+        fat = (fat_cache_t *)cache_get(vol->bdev, sect, CACHE_READ);
+        if (!fat)
+            return -1;
+        set(fat, clst & ((1U << fsp->ent_per_sec_log) - 1), val);
+        cache_dirty(fat, CACHE_FAT);
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Find run of free clusters.
+ *        FAT is scanned a whole sector at a time starting from \p start;
+ *        the search wraps around to cluster #2.
+ * @param vol Volume
+ * @param start Cluster to start from
+ * @param cnt Number of consecutive free clusters needed
+ * @param limit Number of clusters to check; 0 - whole FAT
+ * @return First cluster of the run; CLST_ERR if there is none or on error
+ */
+static uint32_t fat_find_free(fs_volume_t *vol, uint32_t start,
+                              uint32_t cnt, uint32_t limit) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t (*get)(const fat_cache_t *, uint16_t);
+    uint16_t per_sect = 1U << fsp->ent_per_sec_log;
+    uint32_t end = fsp->tot_clusters + 2;
+    // the run may begin before start, so look cnt clusters beyond it
+    uint32_t left = limit ? limit : fsp->tot_clusters + cnt;
+    uint32_t clst = start;
+    uint32_t run = 0;
+    fat_cache_t *fat;
+    uint16_t idx;
+
+    if (!cnt || (cnt > fsp->tot_clusters))
+        return CLST_ERR;
+
+    if ((clst < 2) || (clst >= end))
+        clst = 2;
+
+    get = pgm_read_ptr(&fsp->ent_ops->get);
+
+    while (left) {
+        FS_STAT_ADD(vol, fat_load, 1);
+        fat = (fat_cache_t *)cache_get(vol->bdev,
+                                       fsp->fat_sector +
+                                       (clst >> fsp->ent_per_sec_log),
+                                       CACHE_READ);
+        if (!fat)
+            return CLST_ERR;
+
+        for (idx = clst & (per_sect - 1);
+             (idx < per_sect) && (clst < end) && left;
+             idx++, clst++, left--) {
+            if (get(fat, idx)) {
+                run = 0;
+                continue;
+            }
+            if (++run == cnt)
+                return clst + 1 - cnt;
+        }
+
+        if (clst >= end) {
+            // the run can't wrap around
+            clst = 2;
+            run = 0;
+        }
+    }
+
+    // no space left
+    return CLST_ERR;
+}
+
+/*!
+ * @brief Check whether cluster is free
+ * @param vol Volume
+ * @param clst Cluster
+ * @return 1 if free; 0 if used; -1 on error
+ */
+static int8_t fat_clust_free(fs_volume_t *vol, uint32_t clst) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t (*get)(const fat_cache_t *, uint16_t);
+    fat_cache_t *fat;
+
+    if ((clst < 2) || (clst >= fsp->tot_clusters + 2))
+        return 0;
+
+    FS_STAT_ADD(vol, fat_load, 1);
+    fat = (fat_cache_t *)cache_get(vol->bdev,
+                                   fsp->fat_sector +
+                                   (clst >> fsp->ent_per_sec_log),
+                                   CACHE_READ);
+    if (!fat)
+        return -1;
+
+    get = pgm_read_ptr(&fsp->ent_ops->get);
+
+    return !get(fat, clst & ((1U << fsp->ent_per_sec_log) - 1));
+}
+
+/*!
+ * @brief Round cluster up to the allocation unit boundary
+ * @param fsp FAT specified data
+ * @param clst Cluster
+ * @return First cluster of the unit at or after \p clst
+ */
+static uint32_t fat_au_ceil(const fat_spec_t *fsp, uint32_t clst) {
+    if (clst <= fsp->au_first)
+        return fsp->au_first;
+
+    return fsp->au_first + ((clst - fsp->au_first + fsp->au_clst - 1) /
+                            fsp->au_clst) * fsp->au_clst;
+}
+
+/*!
+ * @brief Find free cluster at the allocation unit boundary.
+ *        Only the first cluster of every unit is checked, so the search
+ *        costs one FAT sector per unit at most.
+ * @param vol Volume
+ * @param start Cluster to start from; the search wraps around
+ * @return Free cluster; CLST_ERR if there is none or on error
+ */
+static uint32_t fat_find_au(fs_volume_t *vol, uint32_t start) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t end = fsp->tot_clusters + 2;
+    uint32_t clst;
+    uint32_t n;
+    int8_t res;
+
+    if (fsp->au_first >= end)
+        return CLST_ERR;
+
+    n = (end - fsp->au_first + fsp->au_clst - 1) / fsp->au_clst;
+    clst = fat_au_ceil(fsp, start);
+
+    while (n--) {
+        if (clst >= end)
+            clst = fsp->au_first;
+        res = fat_clust_free(vol, clst);
+        if (res < 0)
+            return CLST_ERR;
+        if (res)
+            return clst;
+        clst += fsp->au_clst;
+    }
+
+    return CLST_ERR;
+}
+
+/*!
+ * @brief Find free cluster for the chain.
+ *        If the device reports its allocation unit, a chain is continued
+ *        with the next cluster, and a new chain takes free space of the
+ *        current unit (the one of \a next_free) before it starts at the
+ *        boundary of a free unit, so the units of the card are filled one
+ *        by one and each of them is scanned once.
+ * @param vol Volume
+ * @param prev Last cluster of the chain; 0 for a new chain
+ * @return Free cluster; CLST_ERR if there is none or on error
+ */
+static uint32_t fat_find_next(fs_volume_t *vol, uint32_t prev) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t end = fsp->tot_clusters + 2;
+    uint32_t clst;
+    uint32_t au_end;
+    int8_t res;
+
+    if (fsp->au_clst) {
+        if (prev) {
+            res = fat_clust_free(vol, prev + 1);
+            if (res < 0)
+                return CLST_ERR;
+            if (res)
+                return prev + 1;
+        }
+
+        if (fsp->next_free < end) {
+            au_end = fat_au_ceil(fsp, fsp->next_free + 1);
+            if (au_end > end)
+                au_end = end;
+            clst = fat_find_free(vol, fsp->next_free, 1,
+                                 au_end - fsp->next_free);
+            if (clst != CLST_ERR)
+                return clst;
+        }
+
+        if (!(fsp->flags & FAT_F_NO_FREE_AU)) {
+            clst = fat_find_au(vol, fsp->next_free);
+            if (clst != CLST_ERR)
+                return clst;
+            fsp->flags |= FAT_F_NO_FREE_AU;
+        }
+    }
+
+    return fat_find_free(vol, fsp->next_free, 1, 0);
+}
+
+/*!
+ * @brief Chain consecutive clusters together in every FAT copy.
+ *        Each FAT sector is loaded once for all its entries of the run.
+ * @param vol Volume
+ * @param first First cluster of the run
+ * @param cnt Number of clusters
+ * @param link 1 - chain the clusters; 0 - mark them free again
+ * @return 0 on success
+ */
+static int8_t fat_link_run(fs_volume_t *vol, uint32_t first, uint32_t cnt,
+                           uint8_t link) {
+    fat_spec_t *fsp = vol->fs_spec;
+    void (*set)(fat_cache_t *, uint16_t, uint32_t);
+    uint16_t per_sect = 1U << fsp->ent_per_sec_log;
+    fat_cache_t *fat;
+    uint32_t clst;
+    uint32_t left;
+    uint16_t idx;
+
+    set = pgm_read_ptr(&fsp->ent_ops->set);
+
+    for (uint8_t i = 0; i < fat_copies(fsp); i++) {
+        clst = first;
+        left = cnt;
+        while (left) {
+            FS_STAT_ADD(vol, fat_load, 1);
+            fat = (fat_cache_t *)cache_get(vol->bdev,
+                                           fsp->fat_sector +
+                                           (i * fsp->sec_per_fat) +
+                                           (clst >> fsp->ent_per_sec_log),
+                                           CACHE_READ);
+            if (!fat)
+                return -1;
+
+            fat_mirror_mark(fsp, clst >> fsp->ent_per_sec_log);
+            for (idx = clst & (per_sect - 1); (idx < per_sect) && left;
+                 idx++, clst++, left--)
+                // fsp->eoc is the lowest EOC value; mark with the highest one
+                set(fat, idx, !link ? 0 :
+                              (left == 1) ? (fsp->eoc | 0x07) : clst + 1);
+            cache_dirty(fat, CACHE_FAT);
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Discard queued runs of freed clusters.
+ *        The FAT must be on the device: until then the clusters can
+ *        still be reached from it after a power loss.
+ * @param vol Volume
+ */
+static void fat_discard_runs(fs_volume_t *vol) {
+    fat_spec_t *fsp = vol->fs_spec;
+
+    for (uint8_t i = 0; i < fsp->discard_cnt; i++)
+        // not an error if the device can't erase
+        cache_discard(vol->bdev,
+                      get_sect_of_clust(fsp->discard[i].first, fsp),
+                      fsp->discard[i].cnt << fsp->sec_per_clst_log);
+    fsp->discard_cnt = 0;
+}
+
+/*!
+ * @brief Write the cache back and discard queued runs of freed clusters
+ * @param vol Volume
+ * @return 0 on success
+ */
+static int8_t fat_discard_flush(fs_volume_t *vol) {
+    fat_spec_t *fsp = vol->fs_spec;
+
+    if (!fsp->discard_cnt)
+        return 0;
+    if (cache_flush(vol->bdev))
+        return -1;
+    fat_discard_runs(vol);
+
+    return 0;
+}
+
+/*!
+ * @brief Queue run of freed clusters to be discarded.
+ *        A run that continues the last one extends it; a full queue is
+ *        discarded first.
+ * @param vol Volume
+ * @param first First cluster of the run
+ * @param cnt Number of clusters
+ * @return 0 on success
+ */
+static int8_t fat_discard_queue(fs_volume_t *vol, uint32_t first,
+                                uint32_t cnt) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint8_t last = fsp->discard_cnt - 1;
+
+    if (fsp->discard_cnt &&
+        (fsp->discard[last].first + fsp->discard[last].cnt == first)) {
+        fsp->discard[last].cnt += cnt;
+        return 0;
+    }
+
+    if ((fsp->discard_cnt == FS_FAT_DISCARD_RUNS) && fat_discard_flush(vol))
+        return -1;
+
+    fsp->discard[fsp->discard_cnt].first = first;
+    fsp->discard[fsp->discard_cnt].cnt = cnt;
+    fsp->discard_cnt++;
+
+    return 0;
+}
+
+/*!
+ * @brief Take clusters found free for reuse: queued runs are discarded
+ *        now if any of them overlaps, before new data is written there
+ * @param vol Volume
+ * @param clst First cluster
+ * @param cnt Number of clusters
+ * @return 0 on success
+ */
+static int8_t fat_discard_claim(fs_volume_t *vol, uint32_t clst,
+                                uint32_t cnt) {
+    fat_spec_t *fsp = vol->fs_spec;
+
+    for (uint8_t i = 0; i < fsp->discard_cnt; i++) {
+        if ((clst < fsp->discard[i].first + fsp->discard[i].cnt) &&
+            (fsp->discard[i].first < clst + cnt))
+            return fat_discard_flush(vol);
+    }
+
+    return 0;
+}
+
+/*!
+ * @brief Allocate new cluster and append it to the chain
+ * @param vol Volume
+ * @param prev Last cluster of the chain; 0 to start a new chain
+ * @return Allocated cluster; CLST_ERR on error or if volume is full
+ */
+uint32_t fat_alloc_clust(fs_volume_t *vol, uint32_t prev) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t clst;
+
+    // the free clusters count is only a hint: ENOSPC comes from the scan
+    clst = fat_find_next(vol, prev);
+    if ((clst == CLST_ERR) || fat_discard_claim(vol, clst, 1))
+        return CLST_ERR;
+
+    // fsp->eoc is the lowest EOC value; mark with the highest one
+    if (fat_set_entry(vol, clst, fsp->eoc | 0x07))
+        return CLST_ERR;
+
+    if (prev && fat_set_entry(vol, prev, clst)) {
+        fat_set_entry(vol, clst, 0);
+        return CLST_ERR;
+    }
+
+    if (!fsp->free_clst)
+        // the count was wrong
+        fsp->free_clst = FAT_FREE_UNKNOWN;
+    else if (fsp->free_clst != FAT_FREE_UNKNOWN)
+        fsp->free_clst--;
+    fsp->next_free = clst + 1;
+    fat_fsi_dirty(vol);
+    FS_STAT_ADD(vol, alloc, 1);
+
+    return clst;
+}
+
+/*!
+ * @brief Allocate contiguous clusters and append them to the chain.
+ *        The run is linked in one pass, so data of a preallocated file
+ *        can then be written by sector arithmetic without FAT updates.
+ * @param vol Volume
+ * @param prev Last cluster of the chain; 0 to start a new chain
+ * @param cnt Number of clusters
+ * @return First allocated cluster; CLST_ERR on error or if there is
+ *         no free run of \p cnt clusters
+ */
+uint32_t fat_alloc_contig(fs_volume_t *vol, uint32_t prev, uint32_t cnt) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t clst = CLST_ERR;
+
+    // the free clusters count is only a hint: ENOSPC comes from the scan
+    if (fsp->au_clst)
+        // continue the chain or start at the allocation unit boundary
+        clst = fat_find_free(vol, prev ? prev + 1 :
+                             fat_au_ceil(fsp, fsp->next_free), cnt, 0);
+    if (clst == CLST_ERR)
+        clst = fat_find_free(vol, fsp->next_free, cnt, 0);
+    if ((clst == CLST_ERR) || fat_discard_claim(vol, clst, cnt))
+        return CLST_ERR;
+
+    if (fat_link_run(vol, clst, cnt, 1) ||
+        (prev && fat_set_entry(vol, prev, clst))) {
+        // don't lose the run
+        fat_link_run(vol, clst, cnt, 0);
+        return CLST_ERR;
+    }
+
+    if (fsp->free_clst < cnt)
+        // the count was wrong
+        fsp->free_clst = FAT_FREE_UNKNOWN;
+    else if (fsp->free_clst != FAT_FREE_UNKNOWN)
+        fsp->free_clst -= cnt;
+    if (clst == fsp->next_free)
+        fsp->next_free = clst + cnt;
+    fat_fsi_dirty(vol);
+    FS_STAT_ADD(vol, alloc, cnt);
+
+    return clst;
+}
+
+/*!
+ * @brief Preallocate contiguous space.
+ *        The space is discarded on the device, so the file data is
+ *        later written to pre-erased blocks. The clusters are free in
+ *        the FAT on the device: freed ones are detached and written back
+ *        by fat_free_chain(), and queued runs among them are discarded
+ *        by the allocation.
+ * @param vol Volume
+ * @param prev Last cluster of the chain; 0 to start a new chain
+ * @param size Size in bytes
+ * @return First allocated cluster; CLST_ERR on error
+ */
+uint32_t fat_prealloc(fs_volume_t *vol, uint32_t prev, uint32_t size) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint8_t clst_log = fsp->bytes_per_sec_log + fsp->sec_per_clst_log;
+    uint32_t cnt;
+    uint32_t clst;
+
+    if (!size)
+        return CLST_ERR;
+
+    cnt = ((size - 1) >> clst_log) + 1;
+    clst = fat_alloc_contig(vol, prev, cnt);
+    if (clst != CLST_ERR)
+        // not an error if the device can't erase
+        cache_discard(vol->bdev, get_sect_of_clust(clst, fsp),
+                      cnt << fsp->sec_per_clst_log);
+
+    return clst;
+}
+
+/*!
+ * @brief Free cluster chain.
+ *        The cache is written back first: the directory entry or FAT link
+ *        the caller has detached the chain from reaches the device before
+ *        any freed entry, which the FAT class would otherwise precede.
+ *        Every run of consecutive clusters is queued and discarded on
+ *        the device with one call once the freed entries are written:
+ *        by fat_sync(), the next fat_free_chain() or an allocation that
+ *        reuses the run, so the space is erased before it is reused.
+ * @param vol Volume
+ * @param clst First cluster of the chain
+ * @return 0 on success
+ */
+int8_t fat_free_chain(fs_volume_t *vol, uint32_t clst) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t next;
+    uint32_t first = clst;
+
+    if (cache_flush(vol->bdev))
+        return -1;
+    fat_discard_runs(vol);
+
+    while ((clst != CLST_EOC) && (clst != CLST_ERR)) {
+        next = fat_next_clust(vol, clst);
+        if (fat_set_entry(vol, clst, 0))
+            return -1;
+
+        if (fsp->free_clst != FAT_FREE_UNKNOWN)
+            fsp->free_clst++;
+        if (clst < fsp->next_free)
+            fsp->next_free = clst;
+        fsp->flags &= ~FAT_F_NO_FREE_AU;
+        fat_fsi_dirty(vol);
+
+        if (next != clst + 1) {
+            // end of the run
+            if (fat_discard_queue(vol, first, clst - first + 1))
+                return -1;
+            first = next;
+        }
+
+        clst = next;
+    }
+
+    return (clst == CLST_EOC) ? 0 : -1;
+}
+
+#if FS_FAT_MIRROR_RUNS
+/*!
+ * @brief Copy changed sectors of the first FAT to the other copies.
+ *        Each run is copied with multi-block requests.
+ * @param vol Volume
+ * @return 0 on success
+ */
+static int8_t fat_mirror_sync(fs_volume_t *vol) {
+    fat_spec_t *fsp = vol->fs_spec;
+    int8_t ret = 0;
+
+    for (uint8_t r = 0; r < fsp->mirror_cnt; r++) {
+        for (uint8_t i = 1; i < fsp->fat_number; i++) {
+            if (cache_copy(vol->bdev, fsp->fat_sector + fsp->mirror[r].first,
+                           fsp->fat_sector + (i * fsp->sec_per_fat) +
+                           fsp->mirror[r].first,
+                           fsp->mirror[r].last - fsp->mirror[r].first + 1))
+                ret = -1;
+        }
+    }
+
+    if (!ret)
+        fsp->mirror_cnt = 0;
+
+    return ret;
+}
+#endif  /* FS_FAT_MIRROR_RUNS */
+
+/*!
+ * @brief Write FSInfo (if changed) and all modified sectors of the volume;
+ *        discard freed clusters, bring FAT mirrors up to date
+ * @param vol Volume
+ * @return 0 on success
+ */
+int8_t fat_sync(fs_volume_t *vol) {
+    fat_spec_t *fsp = vol->fs_spec;
+    fat_cache_t *cache;
+#if FS_FAT_MSTATE
+    uint8_t changed = fsp->flags & FAT_F_FSI_DIRTY;
+#endif  /* FS_FAT_MSTATE */
+
+    if (fsp->fsi_sector && (fsp->flags & FAT_F_FSI_DIRTY)) {
+        cache = (fat_cache_t *)cache_get(vol->bdev, fsp->fsi_sector,
+                                         CACHE_READ);
+        if (!cache)
+            return -1;
+        cache->fs_info.FSI_Free_Count = fsp->free_clst;
+        cache->fs_info.FSI_Nxt_Free = fsp->next_free;
+        cache_dirty(cache, CACHE_FAT);
+    }
+    fsp->flags &= ~FAT_F_FSI_DIRTY;
+
+    if (cache_flush(vol->bdev))
+        return -1;
+    fat_discard_runs(vol);
+
+#if FS_FAT_MSTATE
+    // the saved state follows FSInfo once the FAT is on the device
+    if (changed)
+        fat_mstate_store(vol);
+#endif  /* FS_FAT_MSTATE */
+
+#if FS_FAT_MIRROR_RUNS
+    return (fsp->flags & FAT_F_NO_MIRROR) ? 0 : fat_mirror_sync(vol);
+#else
+    return 0;
+#endif  /* FS_FAT_MIRROR_RUNS */
+}
@@ -0,0 +1,865 @@
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "fs.h"
+#include "fat.h"
+#include "cache.h"
+#include "dirent.h"
+#include "sys/stat.h"
+
+/*!
+ * @brief Set directory position to its first entry
+ * @param dir Directory
+ */
+void fat_dir_rewind(DIR *dir) {
+    fat_spec_t *fsp = dir->vol->fs_spec;
+
+    // cluster 0 is the fixed root directory of FAT12/FAT16
+    dir->sect = dir->clust ? get_sect_of_clust(dir->clust, fsp) :
+                             fsp->root_sector;
+    dir->offset = 0;
+    dir->entry = NULL;
+}
+
+/*!
+ * @brief Move directory position to the next sector
+ * @param dir Directory
+ * @return 0 on success; 1 at the end of directory; -1 on error
+ */
+int8_t fat_dir_next_sect(DIR *dir) {
+    fat_spec_t *fsp = dir->vol->fs_spec;
+    uint32_t clst;
+
+    dir->offset = 0;
+    dir->entry = NULL;
+
+    if (!dir->clust) {
+        // fixed root directory
+        if (dir->sect + 1 >= fsp->data_sector)
+            return 1;
+        dir->sect++;
+        return 0;
+    }
+
+    if ((dir->sect + 1 - fsp->data_sector) &
+        ((1U << fsp->sec_per_clst_log) - 1)) {
+        // same cluster
+        dir->sect++;
+        return 0;
+    }
+
+    clst = ((dir->sect - fsp->data_sector) >> fsp->sec_per_clst_log) + 2;
+    clst = fat_next_clust(dir->vol, clst);
+    if (clst == CLST_EOC)
+        return 1;
+    if (clst == CLST_ERR)
+        return -1;
+
+    dir->sect = get_sect_of_clust(clst, fsp);
+
+    return 0;
+}
+
+/*!
+ * @brief Convert name to the 11-byte space padded 8.3 form
+ * @param name Name
+ * @param sfn 11 bytes to store short name
+ * @return 0 on success; -1 if \p name is not a valid short name
+ */
+static int8_t fat_name83(const fs_name_t *name, uint8_t *sfn) {
+    uint8_t pos = 0;
+    uint8_t lim = 8;
+    uint8_t c;
+
+    memset(sfn, ' ', 11);
+
+    if ((fs_name_char(name, 0) == '.') &&
+        ((name->len == 1) ||
+         ((name->len == 2) && (fs_name_char(name, 1) == '.')))) {
+        // "." or ".."
+        memset(sfn, '.', name->len);
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < name->len; i++) {
+        c = fs_name_char(name, i);
+
+        if (c == '.') {
+            if (!pos || (lim == 11))
+                // leading or second dot
+                return -1;
+            pos = 8;
+            lim = 11;
+            continue;
+        }
+
+        if ((pos >= lim) || (c < 0x20) ||
+            strchr_P(PSTR("\"*+,/:;<=>?[\\]| "), c))
+            return -1;
+
+        sfn[pos++] = toupper(c);
+    }
+
+    if (sfn[0] == 0xE5)
+        // 0xE5 is the deleted entry mark
+        sfn[0] = 0x05;
+
+    return 0;
+}
+
+/*!
+ * @brief Set directory to the object described by the entry
+ * @param dir Directory to set
+ * @param ent Directory entry of the object
+ * @param sect Sector with \p ent
+ * @param idx Index of \p ent in the sector
+ */
+static void fat_fill_dir(DIR *dir, const dir_t *ent, uint32_t sect,
+                         uint8_t idx) {
+    fat_spec_t *fsp = dir->vol->fs_spec;
+    uint32_t clst = ((uint32_t)ent->DIR_FstClusHI << 16) | ent->DIR_FstClusLO;
+
+    if ((ent->DIR_Attr & ATTR_DIRECTORY) && !clst) {
+        // ".." of the first level directory
+        get_root(dir, dir->vol);
+        return;
+    }
+
+    dir->clust = clst;
+    dir->sect = clst ? get_sect_of_clust(clst, fsp) : 0;
+    dir->offset = 0;
+    dir->entry = NULL;
+    dir->ent_sect = sect;
+    dir->ent_idx = idx;
+    dir->type = (ent->DIR_Attr & ATTR_DIRECTORY) ? DT_DIR : DT_REG;
+}
+
+/*!
+ * @brief Get character of the long name entry
+ * @param ent Long name entry
+ * @param idx Index of the character (0-12)
+ * @return UTF-16 character
+ */
+static uint16_t lfn_char(const ldir_t *ent, uint8_t idx) {
+    if (idx < 5)
+        return ent->LDIR_Name1[idx];
+    if (idx < 11)
+        return ent->LDIR_Name2[idx - 5];
+    return ent->LDIR_Name3[idx - 11];
+}
+
+/*!
+ * @brief Calculate checksum of the short name
+ * @param sfn 11-byte short name
+ * @return Checksum stored in LDIR_Chksum of the long name entries
+ */
+uint8_t fat_sfn_chksum(const uint8_t *sfn) {
+    uint8_t sum = 0;
+
+    for (uint8_t i = 0; i < 11; i++)
+        sum = ((sum & 1) ? 0x80 : 0) + (sum >> 1) + sfn[i];
+
+    return sum;
+}
+
+void fat_lfn_reset(fat_lfn_t *lfn) {
+    lfn->ord = LFN_NONE;
+}
+
+/*!
+ * @brief Check that the entry continues the long name sequence.
+ *        Only ordinal and checksum are checked, no characters.
+ * @param lfn Sequence state
+ * @param ent Long name entry
+ * @return Ordinal of the entry; 0 if it doesn't belong to the sequence
+ */
+static uint8_t fat_lfn_next(fat_lfn_t *lfn, const ldir_t *ent) {
+    uint8_t ord = ent->LDIR_Ord & ~LAST_LONG_ENTRY;
+
+    if (ent->LDIR_Ord & LAST_LONG_ENTRY) {
+        // new sequence
+        lfn->ord = ord;
+        lfn->chksum = ent->LDIR_Chksum;
+        lfn->pos = lfn->size;
+    }
+
+    if (!ord || (ord > LFN_MAX_ENT) || (ord != lfn->ord) ||
+        (ent->LDIR_Chksum != lfn->chksum) || ent->LDIR_Type) {
+        lfn->ord = LFN_NONE;
+        return 0;
+    }
+
+    lfn->ord = ord - 1;
+
+    return ord;
+}
+
+/*!
+ * @brief Take next long name entry.
+ *        If \a buf is set, its characters are decoded to UTF-8 right
+ *        from \p ent; the name is collected at the end of \a buf.
+ * @param lfn Sequence state
+ * @param ent Long name entry
+ */
+void fat_lfn_feed(fat_lfn_t *lfn, const ldir_t *ent) {
+    char tmp[LFN_CHARS_PER_ENT * 3];
+    uint8_t len = 0;
+    uint16_t c;
+
+    if (!fat_lfn_next(lfn, ent) || !lfn->buf)
+        return;
+
+    for (uint8_t i = 0; i < LFN_CHARS_PER_ENT; i++) {
+        c = lfn_char(ent, i);
+        if (!c || (c == 0xFFFF))
+            break;
+
+        if (c < 0x80) {
+            tmp[len++] = c;
+        } else if (c < 0x800) {
+            tmp[len++] = 0xC0 | (c >> 6);
+            tmp[len++] = 0x80 | (c & 0x3F);
+        } else {
+            tmp[len++] = 0xE0 | (c >> 12);
+            tmp[len++] = 0x80 | ((c >> 6) & 0x3F);
+            tmp[len++] = 0x80 | (c & 0x3F);
+        }
+    }
+
+    if (len >= lfn->pos) {
+        // no space for the name and terminator
+        lfn->ord = LFN_NONE;
+        return;
+    }
+
+    lfn->pos -= len;
+    memcpy(lfn->buf + lfn->pos, tmp, len);
+}
+
+/*!
+ * @brief Finish the sequence at the short name entry
+ * @param lfn Sequence state
+ * @param ent Short name entry
+ * @return 1 if the sequence is a valid long name of \p ent (if \a buf is
+ *         set, it holds the name); 0 otherwise
+ */
+uint8_t fat_lfn_done(fat_lfn_t *lfn, const dir_t *ent) {
+    uint8_t ok = !lfn->ord && (fat_sfn_chksum(ent->DIR_Name) == lfn->chksum);
+    uint16_t len;
+
+    lfn->ord = LFN_NONE;
+
+    if (ok && lfn->buf) {
+        len = lfn->size - lfn->pos;
+        memmove(lfn->buf, lfn->buf + lfn->pos, len);
+        lfn->buf[len] = '\0';
+    }
+
+    return ok;
+}
+
+/* Long name to look for */
+typedef struct lfn_target_s {
+    uint8_t units;              // length in UTF-16 chars
+    uint8_t chunk[LFN_MAX_ENT]; // offset in the name of every 13 chars
+} lfn_target_t;
+
+/*!
+ * @brief Decode UTF-8 character of the name
+ * @param name Name
+ * @param pos Offset in the name; moved past the character
+ * @return UTF-16 character; 0xFFFF if not valid or out of BMP
+ */
+static uint16_t utf8_get(const fs_name_t *name, uint8_t *pos) {
+    uint8_t c = fs_name_char(name, (*pos)++);
+    uint16_t ch;
+    uint8_t n;
+
+    if (c < 0x80)
+        return c;
+
+    if ((c & 0xE0) == 0xC0) {
+        ch = c & 0x1F;
+        n = 1;
+    } else if ((c & 0xF0) == 0xE0) {
+        ch = c & 0x0F;
+        n = 2;
+    } else {
+        return 0xFFFF;
+    }
+
+    while (n--) {
+        if (*pos >= name->len)
+            return 0xFFFF;
+        c = fs_name_char(name, (*pos)++);
+        if ((c & 0xC0) != 0x80)
+            return 0xFFFF;
+        ch = (ch << 6) | (c & 0x3F);
+    }
+
+    return ch;
+}
+
+static int8_t lfn_target_init(lfn_target_t *target, const fs_name_t *name) {
+    uint8_t pos = 0;
+    uint16_t units = 0;
+
+    while (pos < name->len) {
+        if (!(units % LFN_CHARS_PER_ENT))
+            target->chunk[units / LFN_CHARS_PER_ENT] = pos;
+        if (utf8_get(name, &pos) == 0xFFFF)
+            return -1;
+        units++;
+    }
+
+    target->units = units;
+
+    return 0;
+}
+
+/*!
+ * @brief Compare characters of the long name entry with the name
+ *        (case insensitive for ASCII)
+ * @param target Prepared name
+ * @param name Name
+ * @param ent Long name entry
+ * @param ord Ordinal of \p ent
+ * @return 1 if matched
+ */
+static uint8_t lfn_match(const lfn_target_t *target, const fs_name_t *name,
+                         const ldir_t *ent, uint8_t ord) {
+    uint8_t pos = target->chunk[ord - 1];
+    uint16_t idx = (ord - 1) * LFN_CHARS_PER_ENT;
+    uint16_t c;
+    uint16_t ch;
+
+    for (uint8_t i = 0; i < LFN_CHARS_PER_ENT; i++, idx++) {
+        c = lfn_char(ent, i);
+        if (idx == target->units)
+            // name must be terminated here
+            return !c;
+
+        ch = utf8_get(name, &pos);
+        if (c < 0x80)
+            c = toupper(c);
+        if (ch < 0x80)
+            ch = toupper(ch);
+        if (c != ch)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*!
+ * @brief Set directory to the parent given by a ".." entry.
+ *        ".." holds only the first cluster, so the entry of the parent
+ *        is searched in the grandparent: the result can then be stat'ed
+ *        like a directory reached by its name.
+ * @param dir Directory; replaced by the parent
+ * @param clst First cluster of the parent; 0 - root
+ * @return 0 on success
+ */
+static int8_t fat_parent(DIR *dir, uint32_t clst) {
+    fat_spec_t *fsp = dir->vol->fs_spec;
+    fat_cache_t *cache;
+    dir_t *ent;
+    dir_t dotdot;
+    DIR pos;
+    uint32_t up;
+
+    if (!clst || (clst == dir->vol->root.clust))
+        return get_root(dir, dir->vol);
+
+    // ".." of the parent is the grandparent
+    if (fat_read_dirent(dir->vol, get_sect_of_clust(clst, fsp), 1, &dotdot))
+        return -1;
+    up = ((uint32_t)dotdot.DIR_FstClusHI << 16) | dotdot.DIR_FstClusLO;
+
+    if (up && (up != dir->vol->root.clust)) {
+        pos = *dir;
+        pos.clust = up;
+    } else {
+        get_root(&pos, dir->vol);
+    }
+    fat_dir_rewind(&pos);
+
+    do {
+        FS_STAT_ADD(pos.vol, dir_scan, 1);
+        cache = (fat_cache_t *)cache_get(pos.vol->bdev, pos.sect, CACHE_READ);
+        if (!cache)
+            return -1;
+
+        ent = cache->dir;
+        for (uint8_t idx = 0; idx < FAT_DIR_PER_SECT; idx++, ent++) {
+            if (!ent->DIR_Name[0])
+                // end of directory
+                return -1;
+
+            if ((ent->DIR_Name[0] == 0xE5) || (ent->DIR_Name[0] == '.') ||
+                ((ent->DIR_Attr & 0x3F) == ATTR_LONG_NAME) ||
+                !(ent->DIR_Attr & ATTR_DIRECTORY))
+                continue;
+
+            if ((((uint32_t)ent->DIR_FstClusHI << 16) |
+                 ent->DIR_FstClusLO) == clst) {
+                fat_fill_dir(dir, ent, pos.sect, idx);
+                return 0;
+            }
+        }
+    } while (!fat_dir_next_sect(&pos));
+
+    return -1;
+}
+
+/*!
+ * @brief Find name in the directory.
+ *        A valid 8.3 name is converted to the 11-byte form once, and
+ *        every entry is checked with a single 11-byte compare; long name
+ *        entries are skipped then. Other names are matched against long
+ *        name sequences: a sequence of other length (the ordinal of its
+ *        first entry) is skipped without comparing characters, the rest
+ *        are compared right in the sector buffer as the entries come, and
+ *        the checksum is verified at the short name entry ending them.
+ * @param dir Directory; replaced by the object found
+ * @param name Name to find
+ * @return 0 on success
+ */
+int8_t fat_lookup(DIR *dir, const fs_name_t *name) {
+    uint8_t sfn[11];
+    lfn_target_t target = {0};
+    fat_lfn_t seq;
+    uint8_t is_long;
+    uint8_t need = 0;
+    uint8_t ord;
+    fat_cache_t *cache;
+    dir_t *ent;
+    DIR pos;
+    int8_t ret;
+
+    is_long = fat_name83(name, sfn) ? 1 : 0;
+    if (is_long) {
+        if (lfn_target_init(&target, name))
+            return -1;
+        need = (target.units + LFN_CHARS_PER_ENT - 1) / LFN_CHARS_PER_ENT;
+    } else if (!dir->ent_sect && (sfn[0] == '.')) {
+        // root has no "." and ".." entries
+        return (sfn[1] == '.') ? get_root(dir, dir->vol) : 0;
+    }
+
+    seq.buf = NULL;
+    seq.size = 0;
+    fat_lfn_reset(&seq);
+
+    pos = *dir;
+    fat_dir_rewind(&pos);
+
+    do {
+        FS_STAT_ADD(pos.vol, dir_scan, 1);
+        cache = (fat_cache_t *)cache_get(pos.vol->bdev, pos.sect, CACHE_READ);
+        if (!cache)
+            return -1;
+
+        ent = cache->dir;
+        for (uint8_t idx = 0; idx < FAT_DIR_PER_SECT; idx++, ent++) {
+            if (!ent->DIR_Name[0])
+                // end of directory
+                return -1;
+
+            if (ent->DIR_Name[0] == 0xE5) {
+                // deleted
+                fat_lfn_reset(&seq);
+                continue;
+            }
+
+            if ((ent->DIR_Attr & 0x3F) == ATTR_LONG_NAME) {
+                const ldir_t *lent = (const ldir_t *)ent;
+
+                if (!is_long)
+                    continue;
+                if ((lent->LDIR_Ord & LAST_LONG_ENTRY) &&
+                    ((lent->LDIR_Ord & ~LAST_LONG_ENTRY) != need)) {
+                    // length doesn't match
+                    fat_lfn_reset(&seq);
+                    continue;
+                }
+                ord = fat_lfn_next(&seq, lent);
+                if (ord && !lfn_match(&target, name, lent, ord))
+                    fat_lfn_reset(&seq);
+                continue;
+            }
+
+            if (ent->DIR_Attr & ATTR_VOLUME_ID) {
+                // volume label
+                fat_lfn_reset(&seq);
+                continue;
+            }
+
+            if (is_long ? fat_lfn_done(&seq, ent) :
+                          !memcmp(ent->DIR_Name, sfn, sizeof(ent->DIR_Name))) {
+                if (sfn[0] == '.')
+                    // ".." points to the parent, not to its entry
+                    return fat_parent(dir, ((uint32_t)ent->DIR_FstClusHI
+                                            << 16) | ent->DIR_FstClusLO);
+                fat_fill_dir(dir, ent, pos.sect, idx);
+                return 0;
+            }
+        }
+    } while (!(ret = fat_dir_next_sect(&pos)));
+
+    return -1;
+}
+
+/* DIR_NTRes flags of lowercase 8.3 names (set by Windows NT and later) */
+#define NT_LOWER_BASE   0x08
+#define NT_LOWER_EXT    0x10
+
+/*!
+ * @brief Convert 11-byte short name to the "NAME.EXT" string
+ * @param ent Directory entry
+ * @param str Buffer for at least 13 chars
+ */
+static void fat_sfn_str(const dir_t *ent, char *str) {
+    uint8_t lower = ent->DIR_NTRes & NT_LOWER_BASE;
+    uint8_t c;
+
+    for (uint8_t i = 0; i < 11; i++) {
+        if (i == 8) {
+            if (ent->DIR_Name[8] == ' ')
+                break;
+            *str++ = '.';
+            lower = ent->DIR_NTRes & NT_LOWER_EXT;
+        }
+
+        c = ent->DIR_Name[i];
+        if (c == ' ')
+            continue;
+        if (!i && (c == 0x05))
+            // 0xE5 stored as 0x05
+            c = 0xE5;
+        *str++ = lower ? tolower(c) : c;
+    }
+
+    *str = '\0';
+}
+
+/*!
+ * @brief Read next directory entry.
+ *        Entries are taken from the cached sector one by one, so every
+ *        sector is read once. Deleted entries, volume label and long name
+ *        entries are skipped; the end mark stops reading of the directory.
+ * @param dir Directory
+ * @param ent Entry to fill; \a d_name must hold FS_NAME_MAX + 1 chars
+ * @return 0 on success; 1 at the end of directory; -1 on error
+ */
+int8_t fat_readdir(DIR *dir, struct dirent *ent) {
+    fat_cache_t *cache;
+    fat_lfn_t lfn;
+    dir_t *de;
+    int8_t ret;
+
+    if (!dir->sect)
+        // end of directory is already reached
+        return 1;
+
+    lfn.buf = ent->d_name;
+    lfn.size = FS_NAME_MAX + 1;
+    fat_lfn_reset(&lfn);
+
+    do {
+        FS_STAT_ADD(dir->vol, dir_scan, 1);
+        cache = (fat_cache_t *)cache_get(dir->vol->bdev, dir->sect,
+                                         CACHE_READ);
+        if (!cache)
+            return -1;
+
+        for (de = &cache->dir[dir->offset]; dir->offset < FAT_DIR_PER_SECT;
+             dir->offset++, de++) {
+            if (!de->DIR_Name[0]) {
+                // end of directory
+                dir->sect = 0;
+                return 1;
+            }
+
+            if (de->DIR_Name[0] == 0xE5) {
+                // deleted
+                fat_lfn_reset(&lfn);
+                continue;
+            }
+
+            if ((de->DIR_Attr & 0x3F) == ATTR_LONG_NAME) {
+                fat_lfn_feed(&lfn, (const ldir_t *)de);
+                continue;
+            }
+
+            if (de->DIR_Attr & ATTR_VOLUME_ID) {
+                // volume label
+                fat_lfn_reset(&lfn);
+                continue;
+            }
+
+            if (!fat_lfn_done(&lfn, de))
+                fat_sfn_str(de, ent->d_name);
+            ent->d_type = (de->DIR_Attr & ATTR_DIRECTORY) ? DT_DIR : DT_REG;
+            dir->offset++;
+
+            return 0;
+        }
+    } while (!(ret = fat_dir_next_sect(dir)));
+
+    if (ret > 0)
+        dir->sect = 0;
+
+    return ret;
+}
+
+/*!
+ * @brief Convert FAT date and time to time_t
+ * @param date FAT date
+ * @param time FAT time
+ * @return Calendar time; 0 if date is not set
+ */
+static time_t fat_time(uint16_t date, uint16_t time) {
+    struct tm tm;
+
+    if (!date)
+        return 0;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = (date >> 9) + 80;
+    tm.tm_mon = ((date >> 5) & 0x0F) - 1;
+    tm.tm_mday = date & 0x1F;
+    tm.tm_hour = time >> 11;
+    tm.tm_min = (time >> 5) & 0x3F;
+    tm.tm_sec = (time & 0x1F) << 1;
+    tm.tm_isdst = -1;
+
+    return mktime(&tm);
+}
+
+/*!
+ * @brief Get attributes of the object
+ * @param dir Object
+ * @param st Struct to store attributes
+ * @return 0 on success
+ */
+int8_t fat_getattr(DIR *dir, struct stat *st) {
+    dir_t ent;
+
+    memset(st, 0, sizeof(*st));
+    st->st_nlink = 1;
+
+    if (!dir->ent_sect) {
+        // root has no entry
+        st->st_mode = S_IFDIR | ACCESSPERMS;
+        return 0;
+    }
+
+    if (fat_read_dirent(dir->vol, dir->ent_sect, dir->ent_idx, &ent))
+        return -1;
+
+    st->st_mode = (ent.DIR_Attr & ATTR_DIRECTORY) ? S_IFDIR : S_IFREG;
+    if (ent.DIR_Attr & ATTR_READ_ONLY)
+        st->st_mode |= ACCESSPERMS & ~(S_IWUSR | S_IWGRP | S_IWOTH);
+    else
+        st->st_mode |= ACCESSPERMS;
+    st->st_size = ent.DIR_FileSize;
+    st->st_atime = fat_time(ent.DIR_LstAccDate, 0);
+    st->st_mtime = fat_time(ent.DIR_WrtDate, ent.DIR_WrtTime);
+    st->st_ctime = fat_time(ent.DIR_CrtDate, ent.DIR_CrtTime);
+
+    return 0;
+}
+
+/*!
+ * @brief Get current time in FAT format
+ * @return Date in the high word, time in the low word
+ */
+uint32_t fat_time_now(void) {
+    time_t now = time(NULL);
+    struct tm *tm = localtime(&now);
+    uint16_t date;
+    uint16_t tim;
+
+    if (!tm || (tm->tm_year < 80))
+        // 1980-01-01
+        return (uint32_t)((1 << 5) | 1) << 16;
+
+    date = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+    tim = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec >> 1);
+
+    return ((uint32_t)date << 16) | tim;
+}
+
+/*!
+ * @brief Find free entry in the directory; extend the directory with
+ *        a new cluster if there is none
+ * @param pos Directory; sector of the free entry on return
+ * @param idx Index of the free entry in the sector
+ * @return 0 on success
+ */
+static int8_t fat_dir_free_ent(DIR *pos, uint8_t *idx) {
+    fat_spec_t *fsp = pos->vol->fs_spec;
+    fat_cache_t *cache;
+    uint32_t clst;
+    uint8_t *data;
+    int8_t ret;
+
+    fat_dir_rewind(pos);
+
+    do {
+        FS_STAT_ADD(pos->vol, dir_scan, 1);
+        cache = (fat_cache_t *)cache_get(pos->vol->bdev, pos->sect,
+                                         CACHE_READ);
+        if (!cache)
+            return -1;
+
+        for (*idx = 0; *idx < FAT_DIR_PER_SECT; (*idx)++) {
+            if (!cache->dir[*idx].DIR_Name[0] ||
+                (cache->dir[*idx].DIR_Name[0] == 0xE5))
+                return 0;
+        }
+    } while (!(ret = fat_dir_next_sect(pos)));
+
+    if ((ret < 0) || !pos->clust)
+        // ENOSPC: fixed root directory is full
+        return -1;
+
+    clst = ((pos->sect - fsp->data_sector) >> fsp->sec_per_clst_log) + 2;
+    clst = fat_alloc_clust(pos->vol, clst);
+    if (clst == CLST_ERR)
+        return -1;
+
+    // zero the new cluster; its first sector is left most recently used
+    pos->sect = get_sect_of_clust(clst, fsp);
+    for (uint8_t i = 1U << fsp->sec_per_clst_log; i; i--) {
+        data = cache_get(pos->vol->bdev, pos->sect + i - 1, CACHE_NOREAD);
+        if (!data)
+            return -1;
+        memset(data, 0, CACHE_SECT_SIZE);
+        cache_dirty(data, CACHE_DIR);
+    }
+    *idx = 0;
+
+    return 0;
+}
+
+/*!
+ * @brief Create empty file.
+ *        Only valid 8.3 names can be created.
+ * @param dir Parent directory; replaced by the file created
+ * @param name Name of the file
+ * @return 0 on success
+ */
+int8_t fat_create(DIR *dir, const fs_name_t *name) {
+    uint8_t sfn[11];
+    fat_cache_t *cache;
+    dir_t *ent;
+    uint32_t now;
+    uint8_t idx;
+    DIR pos;
+
+    if (fat_name83(name, sfn) || (sfn[0] == '.'))
+        // EINVAL
+        return -1;
+
+    pos = *dir;
+    if (fat_dir_free_ent(&pos, &idx))
+        return -1;
+
+    cache = (fat_cache_t *)cache_get(pos.vol->bdev, pos.sect, CACHE_READ);
+    if (!cache)
+        return -1;
+
+    ent = &cache->dir[idx];
+    memset(ent, 0, sizeof(*ent));
+    memcpy(ent->DIR_Name, sfn, sizeof(ent->DIR_Name));
+    ent->DIR_Attr = ATTR_ARCHIVE;
+
+    now = fat_time_now();
+    ent->DIR_CrtDate = now >> 16;
+    ent->DIR_CrtTime = (uint16_t)now;
+    ent->DIR_WrtDate = now >> 16;
+    ent->DIR_WrtTime = (uint16_t)now;
+    ent->DIR_LstAccDate = now >> 16;
+
+    cache_dirty(cache, CACHE_DIR);
+    fat_fill_dir(dir, ent, pos.sect, idx);
+
+    return 0;
+}
+
+/*!
+ * @brief Remove file: mark its entries deleted and free the clusters.
+ *        Long name entries in the previous cluster of the directory are
+ *        left; they are orphans since the checksum matches nothing.
+ * @param dir File object
+ * @return 0 on success
+ */
+int8_t fat_unlink(DIR *dir) {
+    fat_spec_t *fsp = dir->vol->fs_spec;
+    uint8_t spc_mask = (1U << fsp->sec_per_clst_log) - 1;
+    uint32_t sect = dir->ent_sect;
+    uint8_t idx = dir->ent_idx;
+    fat_cache_t *cache;
+    dir_t *ent;
+    ldir_t *lent;
+    uint32_t clst;
+    uint8_t sum;
+    uint8_t ord;
+
+    if (!sect)
+        // EBUSY: root
+        return -1;
+
+    cache = (fat_cache_t *)cache_get(dir->vol->bdev, sect, CACHE_READ);
+    if (!cache)
+        return -1;
+
+    ent = &cache->dir[idx];
+    if (ent->DIR_Attr & ATTR_DIRECTORY)
+        // EISDIR
+        return -1;
+    if (ent->DIR_Attr & ATTR_READ_ONLY)
+        // EACCES
+        return -1;
+
+    clst = ((uint32_t)ent->DIR_FstClusHI << 16) | ent->DIR_FstClusLO;
+    sum = fat_sfn_chksum(ent->DIR_Name);
+    ent->DIR_Name[0] = 0xE5;
+    cache_dirty(cache, CACHE_DIR);
+
+    // long name entries precede the short one
+    for (;;) {
+        if (!idx) {
+            if ((sect >= fsp->data_sector) ?
+                !((sect - fsp->data_sector) & spc_mask) :
+                (sect == fsp->root_sector))
+                // first sector of the cluster or of the root
+                break;
+            sect--;
+            idx = FAT_DIR_PER_SECT;
+            cache = (fat_cache_t *)cache_get(dir->vol->bdev, sect,
+                                             CACHE_READ);
+            if (!cache)
+                return -1;
+        }
+
+        lent = (ldir_t *)&cache->dir[--idx];
+        if (((lent->LDIR_Attr & 0x3F) != ATTR_LONG_NAME) ||
+            (lent->LDIR_Ord == 0xE5) || (lent->LDIR_Chksum != sum))
+            break;
+
+        ord = lent->LDIR_Ord;
+        lent->LDIR_Ord = 0xE5;
+        cache_dirty(cache, CACHE_DIR);
+        if (ord & LAST_LONG_ENTRY)
+            break;
+    }
+
+    return clst ? fat_free_chain(dir->vol, clst) : 0;
+}
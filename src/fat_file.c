@@ -0,0 +1,499 @@
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fs.h"
+#include "fat.h"
+#include "cache.h"
+#include "fcntl.h"
+
+/*!
+ * @brief Get cluster with the byte at the file position.
+ *        The handle keeps the cluster of the byte before the position,
+ *        so FAT is read only when the position crosses a cluster boundary.
+ * @param file File
+ * @param alloc Append new cluster if the chain ends here
+ * @return Cluster; CLST_EOC if the chain ends; CLST_ERR on error
+ */
+static uint32_t fat_file_clust(file_t *file, uint8_t alloc) {
+    fat_spec_t *fsp = file->vol->fs_spec;
+    uint8_t clst_log = fsp->bytes_per_sec_log + fsp->sec_per_clst_log;
+    uint32_t clst;
+
+    if (file->pos & ((1UL << clst_log) - 1))
+        // inside the current cluster
+        return file->clust;
+
+    if (!file->pos)
+        clst = file->fclust ? file->fclust : CLST_EOC;
+#if FS_FILE_EXTENTS
+    else if (file->map.runs &&
+             ((file->pos >> clst_log) < file->map.clusters))
+        // mapped run: no FAT read
+        clst = fat_extmap_clust(file->vol, &file->map,
+                                file->pos >> clst_log);
+#endif  /* FS_FILE_EXTENTS */
+    else
+        clst = fat_next_clust(file->vol, file->clust);
+
+    if ((clst != CLST_EOC) || !alloc)
+        return clst;
+
+    clst = fat_alloc_clust(file->vol, file->pos ? file->clust : 0);
+    if (clst == CLST_ERR)
+        return clst;
+
+    if (!file->pos) {
+        file->fclust = clst;
+        file->flags |= F_DIRTY;
+    }
+#if FS_FILE_EXTENTS
+    fat_extmap_append(&file->map, clst, 1);
+#endif  /* FS_FILE_EXTENTS */
+
+    return clst;
+}
+
+#if FS_READAHEAD
+/*!
+ * @brief Prefetch the sector at the file position and FS_READAHEAD
+ *        sectors after it with one multi-block request. At the end of
+ *        the cluster the FAT is peeked for the next cluster; the request
+ *        continues into it only if it is contiguous.
+ * @param file File
+ * @param clst Cluster at the file position
+ * @param csect Sector at the file position within \p clst
+ */
+static void fat_file_readahead(file_t *file, uint32_t clst, uint8_t csect) {
+    fat_spec_t *fsp = file->vol->fs_spec;
+    uint8_t spc = 1U << fsp->sec_per_clst_log;
+    uint32_t sect = get_sect_of_clust(clst, fsp) + csect;
+    uint32_t left;
+    uint32_t next;
+    uint8_t want = FS_READAHEAD + 1;
+    uint8_t cnt = spc - csect;
+
+    // sectors up to the end of file
+    left = ((file->size - 1) >> fsp->bytes_per_sec_log) -
+           (file->pos >> fsp->bytes_per_sec_log) + 1;
+    if (left < want)
+        want = left;
+
+    if (cnt < want) {
+        next = fat_next_clust(file->vol, clst);
+        if (next == clst + 1) {
+            // contiguous clusters
+            cnt += spc;
+        } else {
+            // the next run is prefetched when the read gets there; doing
+            // it now could evict this run before it is read
+            want = cnt;
+        }
+    }
+
+    cache_prefetch(file->vol->bdev, sect, (cnt < want) ? cnt : want);
+}
+#endif  /* FS_READAHEAD */
+
+/*!
+ * @brief Write size, first cluster and time of the file to its entry
+ * @param file File
+ * @return 0 on success
+ */
+static int8_t fat_file_update(file_t *file) {
+    uint8_t *data;
+    dir_t *ent;
+    uint32_t now;
+
+    data = cache_get(file->vol->bdev, file->ent_sect, CACHE_READ);
+    if (!data)
+        return -1;
+
+    ent = (dir_t *)data + file->ent_idx;
+    ent->DIR_FileSize = file->size;
+    ent->DIR_FstClusHI = file->fclust >> 16;
+    ent->DIR_FstClusLO = (uint16_t)file->fclust;
+    ent->DIR_Attr |= ATTR_ARCHIVE;
+
+    now = fat_time_now();
+    ent->DIR_WrtDate = now >> 16;
+    ent->DIR_WrtTime = (uint16_t)now;
+    ent->DIR_LstAccDate = now >> 16;
+
+    cache_dirty(data, CACHE_DIR);
+    file->flags &= ~F_DIRTY;
+
+    return 0;
+}
+
+/*!
+ * @brief Open file
+ * @param file Handle to fill; \a vol is set
+ * @param dir File object
+ * @param oflag Flags of open()
+ * @return 0 on success
+ */
+int8_t fat_open(file_t *file, const DIR *dir, uint8_t oflag) {
+    uint8_t wr = (oflag & O_ACCMODE) != O_RDONLY;
+    uint32_t clst;
+    dir_t ent;
+
+    if (fat_read_dirent(file->vol, dir->ent_sect, dir->ent_idx, &ent))
+        return -1;
+
+    if (wr && (ent.DIR_Attr & ATTR_READ_ONLY))
+        // EACCES
+        return -1;
+
+    file->fclust = ((uint32_t)ent.DIR_FstClusHI << 16) | ent.DIR_FstClusLO;
+    file->clust = 0;
+    file->pos = 0;
+    file->size = ent.DIR_FileSize;
+    file->ent_sect = dir->ent_sect;
+    file->ent_idx = dir->ent_idx;
+    file->flags = oflag & (O_ACCMODE | O_APPEND);
+#if FS_READAHEAD
+    file->last_sect = 0;
+#endif  /* FS_READAHEAD */
+#if FS_FILE_EXTENTS
+    file->map.ext = file->ext;
+    file->map.size = FS_FILE_EXTENTS;
+    file->map.runs = 0;
+#endif  /* FS_FILE_EXTENTS */
+
+    if (!wr || !(oflag & O_TRUNC) || !file->fclust)
+        return 0;
+
+    // detach the chain from the entry first, then free it
+    clst = file->fclust;
+    file->fclust = 0;
+    file->size = 0;
+    if (fat_file_update(file))
+        return -1;
+
+    return fat_free_chain(file->vol, clst);
+}
+
+/*!
+ * @brief Read from file.
+ *        Whole sectors at sector aligned position go directly to \p buf
+ *        with one request per cluster; the rest is copied from the cache.
+ * @param file File
+ * @param buf Destination
+ * @param count Number of bytes
+ * @return Number of bytes read (0 at the end of file); -1 on error
+ */
+int16_t fat_read(file_t *file, void *buf, uint16_t count) {
+    fat_spec_t *fsp = file->vol->fs_spec;
+    uint16_t sect_size = 1U << fsp->bytes_per_sec_log;
+    uint8_t spc = 1U << fsp->sec_per_clst_log;
+    uint8_t *dst = buf;
+    uint32_t sect;
+    uint16_t done = 0;
+    uint16_t off;
+    uint16_t n;
+    uint8_t csect;
+    uint8_t cnt;
+    uint8_t *data;
+    uint32_t clst;
+
+    if ((file->flags & O_ACCMODE) == O_WRONLY)
+        // EBADF
+        return -1;
+
+    if (file->pos >= file->size)
+        return 0;
+
+    if (count > INT16_MAX)
+        count = INT16_MAX;
+    if (count > file->size - file->pos)
+        count = file->size - file->pos;
+
+    while (done < count) {
+        clst = fat_file_clust(file, 0);
+        if ((clst == CLST_ERR) || (clst == CLST_EOC))
+            break;
+
+        csect = (file->pos >> fsp->bytes_per_sec_log) & (spc - 1);
+        off = file->pos & (sect_size - 1);
+        n = count - done;
+
+        if (!off && (n >= sect_size)) {
+            cnt = spc - csect;
+            if ((n >> fsp->bytes_per_sec_log) < cnt)
+                cnt = n >> fsp->bytes_per_sec_log;
+            if (fat_clust_io(file->vol, clst, csect, cnt, dst, REQ_READ))
+                break;
+            n = (uint16_t)cnt << fsp->bytes_per_sec_log;
+        } else {
+            if (n > sect_size - off)
+                n = sect_size - off;
+            sect = get_sect_of_clust(clst, fsp) + csect;
+#if FS_READAHEAD
+            if (sect == file->last_sect + 1)
+                // sequential reading
+                fat_file_readahead(file, clst, csect);
+            file->last_sect = sect;
+#endif  /* FS_READAHEAD */
+            data = cache_get(file->vol->bdev, sect, CACHE_READ);
+            if (!data)
+                break;
+            memcpy(dst, data + off, n);
+        }
+
+        dst += n;
+        done += n;
+        file->pos += n;
+        file->clust = clst;
+    }
+
+    return (done || (count == 0)) ? (int16_t)done : -1;
+}
+
+/*!
+ * @brief Write to file.
+ *        Whole sectors at sector aligned position go directly from \p buf
+ *        with one request per cluster; the rest is merged in the cache.
+ * @param file File
+ * @param buf Source
+ * @param count Number of bytes
+ * @return Number of bytes written; -1 on error
+ */
+int16_t fat_write(file_t *file, const void *buf, uint16_t count) {
+    fat_spec_t *fsp = file->vol->fs_spec;
+    uint16_t sect_size = 1U << fsp->bytes_per_sec_log;
+    uint8_t spc = 1U << fsp->sec_per_clst_log;
+    const uint8_t *src = buf;
+    uint16_t done = 0;
+    uint16_t off;
+    uint16_t n;
+    uint8_t csect;
+    uint8_t cnt;
+    uint8_t *data;
+    uint32_t clst;
+
+    if ((file->flags & O_ACCMODE) == O_RDONLY)
+        // EBADF
+        return -1;
+
+    if ((file->flags & O_APPEND) && fat_lseek(file, file->size))
+        return -1;
+
+    if (count > INT16_MAX)
+        count = INT16_MAX;
+    if (count > UINT32_MAX - file->pos)
+        // EFBIG
+        count = UINT32_MAX - file->pos;
+
+    while (done < count) {
+        clst = fat_file_clust(file, 1);
+        if ((clst == CLST_ERR) || (clst == CLST_EOC))
+            // ENOSPC
+            break;
+
+        csect = (file->pos >> fsp->bytes_per_sec_log) & (spc - 1);
+        off = file->pos & (sect_size - 1);
+        n = count - done;
+
+        if (!off && (n >= sect_size)) {
+            cnt = spc - csect;
+            if ((n >> fsp->bytes_per_sec_log) < cnt)
+                cnt = n >> fsp->bytes_per_sec_log;
+            if (fat_clust_io(file->vol, clst, csect, cnt, (void *)src,
+                             REQ_WRITE))
+                break;
+            n = (uint16_t)cnt << fsp->bytes_per_sec_log;
+        } else {
+            if (n > sect_size - off)
+                n = sect_size - off;
+            // a sector from the end of file has nothing to keep
+            data = cache_get(file->vol->bdev,
+                             get_sect_of_clust(clst, fsp) + csect,
+                             (!off && (file->pos >= file->size)) ?
+                             CACHE_NOREAD : CACHE_READ);
+            if (!data)
+                break;
+            if (!off && (file->pos >= file->size))
+                memset(data + n, 0, sect_size - n);
+            memcpy(data + off, src, n);
+            cache_dirty(data, CACHE_DATA);
+        }
+
+        src += n;
+        done += n;
+        file->pos += n;
+        file->clust = clst;
+        if (file->pos > file->size)
+            file->size = file->pos;
+        file->flags |= F_DIRTY;
+    }
+
+    return (done || (count == 0)) ? (int16_t)done : -1;
+}
+
+/*!
+ * @brief Set file position.
+ *        Forward seek follows the chain from the current cluster.
+ *        With FS_FILE_EXTENTS the first seek back maps the runs of the
+ *        chain, and then the cluster is found in the map without FAT reads.
+ * @param file File
+ * @param pos New position (up to the file size)
+ * @return 0 on success
+ */
+int8_t fat_lseek(file_t *file, uint32_t pos) {
+    fat_spec_t *fsp = file->vol->fs_spec;
+    uint8_t clst_log = fsp->bytes_per_sec_log + fsp->sec_per_clst_log;
+    uint32_t idx;
+    uint32_t cur;
+    uint32_t clst;
+    uint8_t fwd;
+
+    if (pos > file->size)
+        // EINVAL: no holes
+        return -1;
+
+    if (!pos) {
+        file->clust = 0;
+        file->pos = 0;
+        return 0;
+    }
+
+    idx = (pos - 1) >> clst_log;
+    cur = file->pos ? (file->pos - 1) >> clst_log : 0;
+
+    fwd = file->clust && file->pos && (cur <= idx);
+
+#if FS_FILE_EXTENTS
+    if (!file->map.runs && !fwd &&
+        fat_extmap_build(file->vol, file->fclust, &file->map))
+        // walk the chain as without the map
+        file->map.runs = 0;
+
+    if (file->map.runs)
+        clst = fat_extmap_clust(file->vol, &file->map, idx);
+    else
+#endif  /* FS_FILE_EXTENTS */
+    if (fwd)
+        clst = fat_walk(file->vol, file->clust, idx - cur);
+    else
+        clst = fat_walk(file->vol, file->fclust, idx);
+
+    if ((clst == CLST_ERR) || (clst == CLST_EOC))
+        return -1;
+
+    file->clust = clst;
+    file->pos = pos;
+
+    return 0;
+}
+
+/*!
+ * @brief Store size, first cluster and time of the file in its entry
+ *        (if changed). The entry is written to the device by fat_sync()
+ *        together with other changes of the sector.
+ * @param file File
+ * @return 0 on success
+ */
+int8_t fat_fupdate(file_t *file) {
+    return (file->flags & F_DIRTY) ? fat_file_update(file) : 0;
+}
+
+/*!
+ * @brief Reserve contiguous space for the file.
+ *        The missing clusters are appended to the chain in one run and
+ *        erased on the device, so later writes go to pre-erased blocks
+ *        and don't allocate. The file size doesn't change; clusters that
+ *        are not written by the time the file is closed are freed.
+ * @param file File
+ * @param size Bytes from the start of the file to reserve space for
+ * @return 0 on success; -1 on error or if there is no free run
+ */
+int8_t fat_fprealloc(file_t *file, uint32_t size) {
+    fat_spec_t *fsp = file->vol->fs_spec;
+    uint8_t clst_log = fsp->bytes_per_sec_log + fsp->sec_per_clst_log;
+    uint32_t need = size ? ((size - 1) >> clst_log) + 1 : 0;
+    uint32_t have = 0;
+    uint32_t last = 0;
+    uint32_t next;
+    uint32_t clst;
+
+    if (file->fclust) {
+        // the chain may already be longer than the file
+        if (file->clust && file->pos) {
+            last = file->clust;
+            have = ((file->pos - 1) >> clst_log) + 1;
+        } else {
+            last = file->fclust;
+            have = 1;
+        }
+        while ((next = fat_next_clust(file->vol, last)) != CLST_EOC) {
+            if ((next == CLST_ERR) || (have >= fsp->tot_clusters))
+                return -1;
+            last = next;
+            have++;
+        }
+    }
+
+    if (need <= have)
+        return 0;
+
+    clst = fat_prealloc(file->vol, last, (need - have) << clst_log);
+    if (clst == CLST_ERR)
+        // ENOSPC
+        return -1;
+
+    if (!file->fclust) {
+        file->fclust = clst;
+        file->flags |= F_DIRTY;
+    }
+#if FS_FILE_EXTENTS
+    fat_extmap_append(&file->map, clst, need - have);
+#endif  /* FS_FILE_EXTENTS */
+    file->flags |= F_PREALLOC;
+
+    return 0;
+}
+
+/*!
+ * @brief Free clusters reserved by fat_fprealloc() beyond the file size
+ * @param file File being closed
+ * @return 0 on success
+ */
+int8_t fat_release(file_t *file) {
+    fat_spec_t *fsp = file->vol->fs_spec;
+    uint8_t clst_log = fsp->bytes_per_sec_log + fsp->sec_per_clst_log;
+    uint32_t last;
+    uint32_t next;
+
+    if (!(file->flags & F_PREALLOC))
+        return 0;
+    file->flags &= ~F_PREALLOC;
+
+    if (!file->size) {
+        // detach the chain from the entry first, then free it
+        next = file->fclust;
+        file->fclust = 0;
+        file->clust = 0;
+        if (fat_file_update(file))
+            return -1;
+        return fat_free_chain(file->vol, next);
+    }
+
+    last = fat_walk(file->vol, file->fclust, (file->size - 1) >> clst_log);
+    if ((last == CLST_ERR) || (last == CLST_EOC))
+        return -1;
+
+    next = fat_next_clust(file->vol, last);
+    if (next == CLST_EOC)
+        // all written
+        return 0;
+    if (next == CLST_ERR)
+        return -1;
+
+    // fsp->eoc is the lowest EOC value; mark with the highest one
+    if (fat_set_entry(file->vol, last, fsp->eoc | 0x07))
+        return -1;
+
+    return fat_free_chain(file->vol, next);
+}
@@ -0,0 +1,152 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fs.h"
+#include "fat.h"
+
+#if FS_FAT_MSTATE
+
+static struct {
+    fat_mstate_load_f load;
+    fat_mstate_store_f store;
+    void *arg;
+} slot;
+
+/*!
+ * @brief Set non-volatile slot for the mount state (EEPROM on the target,
+ *        a file on the host). The state is loaded on mount and stored
+ *        when the geometry is read from the boot sector, when the free
+ *        clusters count first changes after that (marked not clean) and
+ *        when FSInfo is written on sync (marked clean).
+ * @param load Read the state of the volume; NULL - off
+ * @param store Write the state of the volume; NULL - off
+ * @param arg User argument of the functions
+ */
+void fat_mstate_set_slot(fat_mstate_load_f load, fat_mstate_store_f store,
+                         void *arg) {
+    slot.load = load;
+    slot.store = store;
+    slot.arg = arg;
+}
+
+/*!
+ * @brief Fletcher-16 checksum of the state without the \a chksum field
+ */
+static uint16_t fat_mstate_sum(const fat_mstate_t *ms) {
+    const uint8_t *p = (const uint8_t *)ms;
+    uint16_t a = 0;
+    uint16_t b = 0;
+
+    for (uint8_t i = 0; i < offsetof(fat_mstate_t, chksum); i++) {
+        a = (a + p[i]) % 255;
+        b = (b + a) % 255;
+    }
+
+    return (b << 8) | a;
+}
+
+/*!
+ * @brief Fill the volume from the saved mount state.
+ *        The state is used only if it matches the boot sector of the volume.
+ * @param vol Volume with allocated fs_spec
+ * @param bpb Boot sector of the volume
+ * @return 0 on success; -1 if there is no valid state
+ */
+int8_t fat_mstate_load(fs_volume_t *vol, const bpb_t *bpb) {
+    fat_spec_t *fsp = vol->fs_spec;
+    fat_mstate_t ms;
+
+    if (!slot.load || slot.load(vol, &ms, sizeof(ms), slot.arg))
+        return -1;
+
+    if ((ms.version != FAT_MSTATE_VER) ||
+        (ms.chksum != fat_mstate_sum(&ms)) ||
+        (ms.start_sector != vol->start_sector) ||
+        (bpb->BS_signature != 0xAA55) ||
+        (ms.vol_id != ((ms.fat_type == FAT32) ?
+                       bpb->fat32_ext.BS_VolID :
+                       bpb->fat12_16_ext.BS_VolID)) ||
+        ((1U << ms.bytes_per_sec_log) != bpb->BPB_BytsPerSec) ||
+        ((1U << ms.sec_per_clst_log) != bpb->BPB_SecPerClus) ||
+        (ms.fat_number != bpb->BPB_NumFATs))
+        // other volume or the volume was formatted again
+        return -1;
+
+    fsp->bytes_per_sec_log = ms.bytes_per_sec_log;
+    fsp->sec_per_clst_log = ms.sec_per_clst_log;
+    fsp->tot_clusters = ms.tot_clusters;
+    fsp->sec_per_fat = ms.sec_per_fat;
+    fsp->fat_number = ms.fat_number;
+    fsp->fat_sector = ms.fat_sector;
+    fsp->root_sector = ms.root_sector;
+    fsp->data_sector = ms.data_sector;
+    fsp->fat_type = ms.fat_type;
+    // after a power loss the count is not known; next_free is only a hint
+    fsp->free_clst = (ms.flags & FAT_MS_CLEAN) ? ms.free_clst :
+                                                 FAT_FREE_UNKNOWN;
+    fsp->next_free = ms.next_free;
+    fsp->fsi_sector = ms.fsi_sector;
+    fsp->flags = ms.flags & FAT_F_NO_MIRROR;
+    fsp->vol_id = ms.vol_id;
+    vol->root.clust = ms.root_clust;
+
+    return 0;
+}
+
+/*!
+ * @brief Check the loaded free clusters count and next free hint against
+ *        FSInfo. Another host that has changed the volume updates FSInfo
+ *        but not the slot: on a mismatch the count is unknown and the
+ *        hint is taken from FSInfo. FAT12/16 have no FSInfo to compare.
+ * @param vol Volume filled by fat_mstate_load()
+ */
+void fat_mstate_verify(fs_volume_t *vol) {
+    fat_spec_t *fsp = vol->fs_spec;
+    uint32_t free_clst = fsp->free_clst;
+    uint32_t next_free = fsp->next_free;
+
+    if (!fsp->fsi_sector)
+        return;
+
+    fat_load_fsinfo(vol);
+    if ((fsp->free_clst != free_clst) || (fsp->next_free != next_free))
+        // stale state or FSInfo can't be read
+        fsp->free_clst = FAT_FREE_UNKNOWN;
+}
+
+/*!
+ * @brief Save mount state of the volume to the slot.
+ *        The state is clean if FSInfo has no pending changes.
+ * @param vol Mounted volume
+ */
+void fat_mstate_store(const fs_volume_t *vol) {
+    const fat_spec_t *fsp = vol->fs_spec;
+    fat_mstate_t ms;
+
+    if (!slot.store)
+        return;
+
+    ms.version = FAT_MSTATE_VER;
+    ms.vol_id = fsp->vol_id;
+    ms.start_sector = vol->start_sector;
+    ms.bytes_per_sec_log = fsp->bytes_per_sec_log;
+    ms.sec_per_clst_log = fsp->sec_per_clst_log;
+    ms.fat_number = fsp->fat_number;
+    ms.fat_type = fsp->fat_type;
+    ms.flags = (fsp->flags & FAT_F_NO_MIRROR) |
+               ((fsp->flags & FAT_F_FSI_DIRTY) ? 0 : FAT_MS_CLEAN);
+    ms.tot_clusters = fsp->tot_clusters;
+    ms.sec_per_fat = fsp->sec_per_fat;
+    ms.fat_sector = fsp->fat_sector;
+    ms.root_sector = fsp->root_sector;
+    ms.data_sector = fsp->data_sector;
+    ms.fsi_sector = fsp->fsi_sector;
+    ms.root_clust = vol->root.clust;
+    ms.free_clst = fsp->free_clst;
+    ms.next_free = fsp->next_free;
+    ms.chksum = fat_mstate_sum(&ms);
+
+    slot.store(vol, &ms, sizeof(ms), slot.arg);
+}
+
+#endif  /* FS_FAT_MSTATE */
@@ -0,0 +1,22 @@
+/*
+    fcntl.h - file control options
+*/
+
+#ifndef FCNTL_H
+#define FCNTL_H
+
+#include <stdint.h>
+
+/* open() flags */
+#define O_RDONLY    0x00    // open for reading only
+#define O_WRONLY    0x01    // open for writing only
+#define O_RDWR      0x02    // open for reading and writing
+#define O_ACCMODE   0x03    // mask for access mode
+#define O_CREAT     0x04    // create file if it does not exist
+#define O_EXCL      0x08    // fail if file exists (with O_CREAT)
+#define O_TRUNC     0x10    // truncate file to zero length
+#define O_APPEND    0x20    // set file position to the end before each write
+
+int8_t open(const char *path, uint8_t oflag);
+
+#endif  /* !FCNTL_H */
@@ -11,6 +11,10 @@
 
 #include "fs.h"
 #include "block_dev.h"
+#include "cache.h"
+#include "dcache.h"
+#include "unistd.h"
+#include "fcntl.h"
 
 //============== MBR ==================
 
@@ -100,11 +104,7 @@ typedef union fs_cache {
     uint8_t data[512];
 } fs_cache_t;
 
-extern int8_t fat_init(fs_volume_t *vol, req_t *req);
-
-int8_t fs_follow_path(DIR *restrict dir,
-                      const char *restrict path,
-                      uint8_t flags);
+extern int8_t fat_init(fs_volume_t *vol);
 
 static struct {
     fs_volume_t *next;
@@ -112,6 +112,11 @@ static struct {
 
 static DIR pwd = {0};
 
+static file_t files[FS_OPEN_MAX];  // open file table; index is fd
+
+static char dent_name[FS_NAME_MAX + 1];
+static struct dirent dent = {.d_name = dent_name};
+
 /*!
  * @return volume number; -1 on error (if vol_num > 127)
  */
@@ -204,33 +209,76 @@ static fs_volume_t *vtable_get_vol(uint8_t num) {
 
 /*!
  * @brief Get volume number by string
- * @param str String (e.g. "12:/my/path/to/file")
+ * @param str String (e.g. "12:/my/path/to/file"); on success moved
+ *            past the ':'
+ * @param flags FP_PGM if \p str is in program memory
  * @return 0-127 - volume number; -1 on error
  */
-static int8_t get_vol_num_by_str(const char *str) {
-    long num;
-    char *endptr;
+static int8_t get_vol_num_by_str(const char **str, uint8_t flags) {
+    const char *cp = *str;
+    uint8_t num = 0;
+    char c;
 
-    num = strtol(str, &endptr, 10);
-    if (((num == 0) && (endptr == str)) ||
-        (num > 127) || (num < 0) || (*endptr++ != ':') ||
-        ((*endptr != '/') && (*endptr != '\\')))
+    c = fs_path_char(cp, flags);
+    if (!isdigit(c))
+        return -1;
+
+    do {
+        num = num * 10 + (c - '0');
+        if (num > 127)
+            return -1;
+        c = fs_path_char(++cp, flags);
+    } while (isdigit(c));
+
+    if ((c != ':') ||
+        ((fs_path_char(cp + 1, flags) != '/') &&
+         (fs_path_char(cp + 1, flags) != '\\')))
         // is not volume number
         return -1;
 
-    return (int8_t)(num & 0xFF);
+    *str = cp + 1;
+
+    return (int8_t)num;
+}
+
+/*!
+ * @brief Read file system of the volume if it is not mounted yet
+ * @param vol Volume
+ * @return 0 on success
+ */
+static int8_t vol_mount(fs_volume_t *vol) {
+    if (vol->fs_spec)
+        return 0;
+
+    // type is checked by v_det(); FAT is the only one supported
+    if (fat_init(vol)) {
+        vol->fs_spec = NULL;
+        return -1;
+    }
+
+    return 0;
 }
 
 /*!
- * @brief Get root directory of specified volume
+ * @brief Get root directory of specified volume.
+ *        With FS_LAZY_MOUNT the volume is mounted here on first access.
  * @param dir Directory entry to store root
  * @param vol Specified volume
  * @return 0 on success
  */
-int8_t get_root(DIR *restrict dir, const fs_volume_t *restrict vol) {
+int8_t get_root(DIR *restrict dir, fs_volume_t *restrict vol) {
     if (!vol)
         return -1;
 
+#if FS_LAZY_MOUNT
+    if (vol_mount(vol))
+        return -1;
+#else
+    if (!vol->fs_spec)
+        // unmounted
+        return -1;
+#endif  /* FS_LAZY_MOUNT */
+
     memcpy(dir, &vol->root, sizeof(DIR));
 
     return 0;
@@ -250,12 +298,10 @@ void set_pwd(const char *path) {
     else
         err = fs_follow_path(&new_pwd, path, 0);
 
-    if (!err)
+    if (err)
         return;
 
-    if (pwd.vol && pwd.name)
-        free(pwd.name);
-
+    // name is owned by the volume root
     memcpy(&pwd, &new_pwd, sizeof(DIR));
 
     return;
@@ -266,84 +312,618 @@ void get_pwd(DIR *dir) {
         memcpy(dir, &pwd, sizeof(DIR));
 }
 
-static int8_t get_start_entry(const char *restrict *path,
-                              DIR *restrict dir) {
+/*!
+ * @brief Get directory to start path resolution from.
+ *        Path "N:/..." starts from root of volume N, "/..." from root of
+ *        the base (or PWD) volume, other paths from the base directory
+ *        (or PWD).
+ * @param path Pathname; volume prefix is skipped
+ * @param dir Base directory (if dir->vol is set); start directory on return
+ * @param flags FP_PGM if \p path is in program memory
+ * @return 0 on success
+ */
+static int8_t get_start_entry(const char **path, DIR *dir, uint8_t flags) {
+    int8_t vol_num;
+    char c;
+
+    vol_num = get_vol_num_by_str(path, flags);
+    if (vol_num >= 0)
+        return get_root(dir, vtable_get_vol(vol_num));
+    // if vol_num < 0, path is relative or from root of current volume
+
+    if (!dir->vol) {
+        get_pwd(dir);
+#if FS_LAZY_MOUNT
+        if (!dir->vol)
+            // PWD is not set; volume 0 is not mounted until now
+            return get_root(dir, vtable_get_vol(0));
+#else
+        if (!dir->vol)
+            // PWD is not set
+            return -1;
+#endif  /* FS_LAZY_MOUNT */
+    }
+
+    c = fs_path_char(*path, flags);
+    if ((c == '/') || (c == '\\'))
+        return get_root(dir, dir->vol);
+
+    return 0;
+}
+
+/*!
+ * @brief Get next component of the path without copying it
+ * @param path Pathname; moved past the component
+ * @param name Component to fill
+ * @param flags FP_PGM if \p path is in program memory
+ * @return 1 if component found; 0 at the end of path; -1 if too long
+ */
+static int8_t path_next(const char **path, fs_name_t *name, uint8_t flags) {
     const char *cp = *path;
+    uint16_t hash = 0;
+    uint16_t len = 0;
+    char c;
+
+    while (((c = fs_path_char(cp, flags)) == '/') || (c == '\\'))
+        cp++;
+
+    name->name = cp;
+    while (c && (c != '/') && (c != '\\')) {
+        hash = (hash << 5) - hash + toupper(c);
+        c = fs_path_char(++cp, flags);
+        len++;
+    }
+
+    if (len > 255)
+        // ENAMETOOLONG
+        return -1;
 
-    if (dir->vol)   // start entry already present
+    name->len = len;
+    name->flags = flags & FP_PGM;
+    name->hash = hash;
+    *path = cp;
+
+    return len ? 1 : 0;
+}
+
+/*!
+ * @brief Look up name in the directory
+ * @param dir Directory; replaced by the object found
+ * @param name Name to find
+ * @return 0 on success
+ */
+static int8_t fs_lookup(DIR *dir, const fs_name_t *name) {
+    int8_t (*lookup)(DIR *, const fs_name_t *);
+    uint32_t parent = dir->clust;
+
+    if (dir->type != DT_DIR)
+        // ENOTDIR
+        return -1;
+
+    if ((name->len == 1) && (fs_name_char(name, 0) == '.'))
+        return 0;
+
+    if (!dcache_lookup(dir, name))
         return 0;
 
-    get_pwd(dir);
-    if (!dir->vol)
-        // PWD is not set
+    lookup = pgm_read_ptr(&dir->vol->v_ops->lookup);
+    if (!lookup || lookup(dir, name))
+        // ENOENT
         return -1;
 
-    if ((cp[0] == '/') || (cp[0] == '\\') ) {
-        /** TODO: */
-        return get_root(dir, dir->vol);
-    } else if (isdigit(cp[0])) {
-        /** TODO: */
-        int8_t vol_num = get_vol_num_by_str(cp);
+    dcache_add(parent, name, dir);
+
+    return 0;
+}
+
+/*!
+ * @brief Resolve path
+ * @param dir Base directory (if dir->vol is set); object found on return
+ * @param path Pathname
+ * @param flags FP_PGM if \p path is in program memory
+ * @param last If not NULL, resolve parent directory of the path
+ *             and store the last component here
+ * @return 0 on success
+ */
+static int8_t path_walk(DIR *dir, const char *path,
+                        uint8_t flags, fs_name_t *last) {
+    fs_name_t name;
+    fs_name_t next;
+    int8_t ret;
+    int8_t ret_next;
 
-        if (vol_num >= 0)
-            /** TODO: */
-            return get_root(dir, vtable_get_vol(vol_num));
+    // check if path == NULL or path[0] == '\0' or dir == NULL
+    if (!path || !fs_path_char(path, flags) || !dir)
+        return -1;
+
+    if (get_start_entry(&path, dir, flags))
+        return -1;
+
+    ret = path_next(&path, &name, flags);
+    while (ret > 0) {
+        ret_next = path_next(&path, &next, flags);
+        if (ret_next < 0)
+            return -1;
+
+        if (last && !ret_next) {
+            *last = name;
+            return 0;
+        }
+
+        if (fs_lookup(dir, &name))
+            return -1;
 
-        // if vol_num < 0, path is pwd
+        name = next;
+        ret = ret_next;
     }
 
-    return 0;
+    // no last component (e.g. "0:/")
+    return (ret || last) ? -1 : 0;
 }
 
+/*!
+ * @brief Resolve path to the object
+ * @param dir Base directory (if dir->vol is set); object found on return
+ * @param path Pathname
+ * @param flags FP_PGM if \p path is in program memory
+ * @return 0 on success
+ */
 int8_t fs_follow_path(DIR *restrict dir,
                       const char *restrict path,
                       uint8_t flags) {
-    int8_t ret = -1;
-    char *node;
+    return path_walk(dir, path, flags, NULL);
+}
 
-    // check if path == NULL or path[0] == '\0' or dir == NULL
-    if (!path || !*path || !dir)
-        return ret;
+/*!
+ * @brief Check whether the file is open
+ * @param dir Directory entry of the file
+ * @param wr Nonzero to check only descriptors open for writing
+ * @return 1 if open
+ */
+static uint8_t file_is_open(const DIR *dir, uint8_t wr) {
+    for (uint8_t fd = 0; fd < FS_OPEN_MAX; fd++) {
+        if ((files[fd].vol == dir->vol) &&
+            (files[fd].ent_sect == dir->ent_sect) &&
+            (files[fd].ent_idx == dir->ent_idx) &&
+            (!wr || (files[fd].flags & O_ACCMODE)))
+            return 1;
+    }
 
-    ret = get_start_entry(&path, dir);
+    return 0;
+}
+
+/*!
+ * @brief Remove directory entry of the file.
+ *        Open file can't be removed: its clusters would be reused.
+ * @param path Pathname
+ * @return 0 on success
+ */
+int8_t unlink(const char *path) {
+    int8_t (*op)(DIR *);
+    DIR dir = {0};
+
+    if (fs_follow_path(&dir, path, 0))
+        return -1;
+
+    if (file_is_open(&dir, 0))
+        // EBUSY
+        return -1;
+
+    op = pgm_read_ptr(&dir.vol->v_ops->unlink);
+    if (!op)
+        // ENOSYS
+        return -1;
 
-    // node = strsep_P(&path, PSTR("\\/"));
+    dcache_invalidate(dir.vol);
 
-    return -1;
+    return op(&dir);
 }
 
-static int8_t v_det(bdev_t *bdev) {
-    int8_t ret;
-    fs_cache_t cache;
-    req_f req_func;
-    req_t req;
-    mbr_part_t part_list[4];
-    mbr_part_t *part = part_list;
+/*!
+ * @brief Open directory stream
+ * @param dirname Pathname of the directory
+ * @return Directory stream; NULL on error
+ */
+DIR *opendir(const char *dirname) {
+    DIR *dir = malloc(sizeof(DIR));
+
+    if (!dir)
+        // ENOMEM
+        return NULL;
+    dir->vol = NULL;
+
+    if (fs_follow_path(dir, dirname, 0) || (dir->type != DT_DIR) ||
+        !pgm_read_ptr(&dir->vol->v_ops->readdir)) {
+        // ENOENT, ENOTDIR
+        free(dir);
+        return NULL;
+    }
+
+    rewinddir(dir);
+#if FS_LAZY_MOUNT
+    dir->vol->dir_open++;
+#endif  /* FS_LAZY_MOUNT */
+
+    return dir;
+}
+
+/*!
+ * @brief Read next entry of directory stream
+ * @param dirp Directory stream
+ * @return Entry; NULL at the end of directory or on error.
+ *         Entry is overwritten by the next call.
+ */
+struct dirent *readdir(DIR *dirp) {
+    int8_t (*op)(DIR *, struct dirent *);
+
+    if (!dirp)
+        // EBADF
+        return NULL;
+
+    op = pgm_read_ptr(&dirp->vol->v_ops->readdir);
+
+    return op(dirp, &dent) ? NULL : &dent;
+}
+
+/*!
+ * @brief Reset directory stream to the beginning of directory
+ * @param dirp Directory stream
+ */
+void rewinddir(DIR *dirp) {
+    void (*op)(DIR *);
+
+    if (!dirp)
+        return;
+
+    op = pgm_read_ptr(&dirp->vol->v_ops->rewinddir);
+    if (op)
+        op(dirp);
+}
+
+/*
+ * Position cookie of directory stream: sector (from start of volume)
+ * and entry offset in it. Directory is continued right from there,
+ * without scanning it from the beginning. 0 is the end of directory.
+ * long is 32 bits on AVR and the cookie must stay positive, so the
+ * sector has 26 bits: directories in the first 32 GiB (with 512-byte
+ * sectors) of the volume can be told.
+ */
+#define DIRPOS_OFFSET_BITS  5
+#define DIRPOS_SECT_MAX     (1UL << (31 - DIRPOS_OFFSET_BITS))
+
+/*!
+ * @brief Get current position of directory stream
+ * @param dirp Directory stream
+ * @return Position for seekdir(); -1 on error or if the directory
+ *         sector is beyond the cookie range
+ */
+long telldir(DIR *dirp) {
+    uint32_t sect;
+
+    if (!dirp)
+        // EBADF
+        return -1;
+
+    if (!dirp->sect)
+        return 0;
+
+    sect = dirp->sect - dirp->vol->start_sector;
+    if (sect >= DIRPOS_SECT_MAX)
+        // EOVERFLOW
+        return -1;
+
+    return (long)((sect << DIRPOS_OFFSET_BITS) | dirp->offset);
+}
+
+/*!
+ * @brief Set position of directory stream
+ * @param dirp Directory stream
+ * @param loc Position returned by telldir()
+ */
+void seekdir(DIR *dirp, long loc) {
+    uint32_t pos = (uint32_t)loc;
+
+    if (!dirp || (loc == -1))
+        return;
+
+    dirp->sect = pos ? (pos >> DIRPOS_OFFSET_BITS) + dirp->vol->start_sector :
+                       0;
+    dirp->offset = pos & ((1U << DIRPOS_OFFSET_BITS) - 1);
+    dirp->entry = NULL;
+}
+
+/*!
+ * @brief Close directory stream
+ * @param dirp Directory stream
+ * @return 0 on success
+ */
+int8_t closedir(DIR *dirp) {
+    if (!dirp)
+        // EBADF
+        return -1;
+
+#if FS_LAZY_MOUNT
+    dirp->vol->dir_open--;
+#endif  /* FS_LAZY_MOUNT */
+    free(dirp);
+
+    return 0;
+}
+
+/*!
+ * @brief Get open file by descriptor
+ * @return File; NULL if \p fd is not open
+ */
+static file_t *fd_get(int8_t fd) {
+    if ((fd < 0) || (fd >= FS_OPEN_MAX) || !files[fd].vol)
+        // EBADF
+        return NULL;
+
+    return &files[fd];
+}
+
+/*!
+ * @brief Open file.
+ *        A file open for writing can't be opened again, and a file open
+ *        for reading can't be opened for writing.
+ * @param path Pathname
+ * @param oflag O_RDONLY, O_WRONLY or O_RDWR with O_CREAT, O_EXCL,
+ *              O_TRUNC, O_APPEND
+ * @return File descriptor; -1 on error
+ */
+int8_t open(const char *path, uint8_t oflag) {
+    int8_t (*create)(DIR *, const fs_name_t *);
+    int8_t (*op)(file_t *, const DIR *, uint8_t);
+    fs_name_t name;
+    DIR parent = {0};
+    DIR dir;
+    int8_t fd;
+
+    for (fd = 0; (fd < FS_OPEN_MAX) && files[fd].vol; fd++)
+        ;
+    if (fd == FS_OPEN_MAX)
+        // EMFILE
+        return -1;
+
+    if (path_walk(&parent, path, 0, &name))
+        return -1;
+
+    dir = parent;
+    if (fs_lookup(&dir, &name)) {
+        if (!(oflag & O_CREAT))
+            // ENOENT
+            return -1;
+
+        dir = parent;
+        create = pgm_read_ptr(&dir.vol->v_ops->create);
+        if (!create || create(&dir, &name))
+            return -1;
+    } else if ((oflag & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL)) {
+        // EEXIST
+        return -1;
+    }
+
+    if (dir.type != DT_REG)
+        // EISDIR
+        return -1;
+
+    // size and chain of a file being written live in its descriptor:
+    // one writer and no readers beside it
+    if (file_is_open(&dir, !(oflag & O_ACCMODE)))
+        // EBUSY
+        return -1;
+
+    op = pgm_read_ptr(&dir.vol->v_ops->open);
+    if (!op)
+        // ENOSYS
+        return -1;
+
+    files[fd].vol = dir.vol;
+    if (op(&files[fd], &dir, oflag)) {
+        files[fd].vol = NULL;
+        return -1;
+    }
+
+    return fd;
+}
+
+/*!
+ * @brief Read from file
+ * @param fd File descriptor
+ * @param buf Destination
+ * @param count Number of bytes
+ * @return Number of bytes read (0 at the end of file); -1 on error
+ */
+int16_t read(int8_t fd, void *buf, uint16_t count) {
+    int16_t (*op)(file_t *, void *, uint16_t);
+    file_t *file = fd_get(fd);
 
-    req_func = pgm_read_ptr(&bdev->blk_ops->request);
-    if (!req_func)
-        // no request function
+    if (!file)
         return -1;
 
-    // fill request
-    req.bdev = bdev;
-    req.cmd_flags = REQ_READ;
-    req.block = 0;
-    req.buf = &cache;
+    op = pgm_read_ptr(&file->vol->v_ops->read);
+
+    return op ? op(file, buf, count) : -1;
+}
+
+/*!
+ * @brief Write to file
+ * @param fd File descriptor
+ * @param buf Source
+ * @param count Number of bytes
+ * @return Number of bytes written; -1 on error
+ */
+int16_t write(int8_t fd, const void *buf, uint16_t count) {
+    int16_t (*op)(file_t *, const void *, uint16_t);
+    file_t *file = fd_get(fd);
+
+    if (!file)
+        return -1;
+
+    op = pgm_read_ptr(&file->vol->v_ops->write);
+
+    return op ? op(file, buf, count) : -1;
+}
+
+/*!
+ * @brief Set file position
+ * @param fd File descriptor
+ * @param offset Offset from \p whence
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END
+ * @return New position; -1 on error
+ */
+int32_t lseek(int8_t fd, int32_t offset, uint8_t whence) {
+    int8_t (*op)(file_t *, uint32_t);
+    file_t *file = fd_get(fd);
+    uint32_t pos;
+
+    if (!file)
+        return -1;
+
+    if (whence == SEEK_SET)
+        pos = 0;
+    else if (whence == SEEK_CUR)
+        pos = file->pos;
+    else if (whence == SEEK_END)
+        pos = file->size;
+    else
+        // EINVAL
+        return -1;
+
+    if (((offset < 0) && ((uint32_t)-offset > pos)) ||
+        ((uint32_t)(pos + offset) > INT32_MAX))
+        // EINVAL, EOVERFLOW
+        return -1;
+    pos += offset;
+
+    op = pgm_read_ptr(&file->vol->v_ops->lseek);
+    if (!op || op(file, pos))
+        return -1;
+
+    return (int32_t)pos;
+}
+
+/*!
+ * @brief Write modified data and attributes of the file to the device
+ * @param fd File descriptor
+ * @return 0 on success
+ */
+int8_t fsync(int8_t fd) {
+    int8_t (*update)(file_t *);
+    int8_t (*op)(fs_volume_t *);
+    file_t *file = fd_get(fd);
+
+    if (!file)
+        return -1;
+
+    update = pgm_read_ptr(&file->vol->v_ops->fupdate);
+    if (update && update(file))
+        return -1;
+
+    op = pgm_read_ptr(&file->vol->v_ops->syncfs);
+
+    return op ? op(file->vol) : cache_flush(file->vol->bdev);
+}
+
+/*!
+ * @brief Write modified data of all files and volumes to the devices.
+ *        Entries of all files are updated first, so each directory
+ *        sector is written once.
+ */
+void sync(void) {
+    int8_t (*update)(file_t *);
+    int8_t (*op)(fs_volume_t *);
+    fs_volume_t *vol;
+
+    for (uint8_t fd = 0; fd < FS_OPEN_MAX; fd++) {
+        if (!files[fd].vol)
+            continue;
+        update = pgm_read_ptr(&files[fd].vol->v_ops->fupdate);
+        if (update)
+            update(&files[fd]);
+    }
+
+    for (vol = vol_tbl.next; vol; vol = vol->next) {
+        if (!vol->fs_spec)
+            // not mounted
+            continue;
+        op = pgm_read_ptr(&vol->v_ops->syncfs);
+        if (op)
+            op(vol);
+    }
+
+    cache_flush(NULL);
+}
+
+/*!
+ * @brief Close file
+ * @param fd File descriptor
+ * @return 0 on success
+ */
+int8_t close(int8_t fd) {
+    int8_t (*release)(file_t *);
+    file_t *file = fd_get(fd);
+    int8_t ret = 0;
+
+    if (!file)
+        return -1;
+
+    if ((file->flags & O_ACCMODE) != O_RDONLY) {
+        release = pgm_read_ptr(&file->vol->v_ops->release);
+        if (release && release(file))
+            ret = -1;
+        if (fsync(fd))
+            ret = -1;
+    }
+    file->vol = NULL;
+
+    return ret;
+}
+
+/*!
+ * @brief Reserve contiguous space for the file.
+ *        Writes up to \p size bytes then need no allocation and go to
+ *        blocks erased in advance. The file size doesn't change; the
+ *        space that is not written is freed by close().
+ * @param fd File descriptor (open for writing)
+ * @param size Bytes from the start of the file to reserve space for
+ * @return 0 on success; -1 on error or if there is no contiguous space
+ */
+int8_t fs_prealloc(int8_t fd, uint32_t size) {
+    int8_t (*op)(file_t *, uint32_t);
+    file_t *file = fd_get(fd);
 
-    ret = req_func(&req);
-    if (ret)
+    if (!file || ((file->flags & O_ACCMODE) == O_RDONLY))
+        // EBADF
+        return -1;
+
+    op = pgm_read_ptr(&file->vol->v_ops->prealloc);
+    if (!op)
+        // EOPNOTSUPP
+        return -1;
+
+    return op(file, size);
+}
+
+static int8_t v_det(bdev_t *bdev) {
+    int8_t ret = 0;
+    fs_cache_t *cache;
+    mbr_part_t part_list[4];
+    mbr_part_t *part = part_list;
+
+    cache = (fs_cache_t *)cache_get(bdev, 0, CACHE_READ);
+    if (!cache)
         // some err
-        return ret;
+        return -1;
 
-    if (cache.mbr.boot_signature != 0xAA55) {
+    if (cache->mbr.boot_signature != 0xAA55) {
         // not mapped
         printf_P(PSTR("storage is not mapped\n"));
         return 0;
     }
 
     // copying the list of partitions to free the cache
-    memcpy(part_list, cache.mbr.partition, sizeof(part_list));
+    memcpy(part_list, cache->mbr.partition, sizeof(part_list));
 
     for (uint8_t i = 0; i < 4; i++, part++) {
         fs_volume_t *vol;
@@ -360,10 +940,17 @@ static int8_t v_det(bdev_t *bdev) {
             // ENOMEM
             return -1;
 
+#if FS_STATS
+        memset(&vol->stats, 0, sizeof(vol->stats));
+#endif  /* FS_STATS */
+#if FS_LAZY_MOUNT
+        vol->dir_open = 0;
+#endif  /* FS_LAZY_MOUNT */
         vol->start_sector = part->start_lba;
         vol->tot_sectors = part->total_sectors;
         vol->fs_type = part->fs_id;
         vol->bdev = bdev;
+        vol->fs_spec = NULL;
 
         switch (part->fs_id) {
             case FAT12:
@@ -372,7 +959,12 @@ static int8_t v_det(bdev_t *bdev) {
             case FAT32:
             case FAT32X:
             case FAT16X:
-                ret = fat_init(vol, &req);
+#if FS_LAZY_MOUNT
+                // only the partition is recorded; see get_root()
+                ret = 0;
+#else
+                ret = vol_mount(vol);
+#endif  /* FS_LAZY_MOUNT */
                 break;
 
             case NTOS:
@@ -380,9 +972,8 @@ static int8_t v_det(bdev_t *bdev) {
 
             case EFI:
                 /** TODO: GPT
-                req.block = 1;
-                err = req_func(&req);
-                if (!memcmp_P(cache.gpt.signature, PSTR("EFI PART"), 8)) {
+                cache = (fs_cache_t *)cache_get(bdev, 1, CACHE_READ);
+                if (cache && !memcmp_P(cache->gpt.signature, PSTR("EFI PART"), 8)) {
                     // check all CRC
                     // ...
                     // is GPT
@@ -417,10 +1008,12 @@ static int8_t v_det(bdev_t *bdev) {
             sprintf_P(vol->root.name, PSTR("%u:/"), vol->v_num);
         }
 
+#if !FS_LAZY_MOUNT
         if (vol->v_num == 0)
             set_pwd(NULL);  // set PWD as root of "0:/>"
 
         printf_P(PSTR("Vol %u; fs 0x%02X\n"), vol->v_num, vol->fs_type);
+#endif  /* !FS_LAZY_MOUNT */
     }
 
     return ret;
@@ -434,3 +1027,149 @@ static int8_t v_det(bdev_t *bdev) {
 int8_t volumes_determine(spi_dev_t *dev) {
     return v_det(spi_get_priv(dev));
 }
+
+#if FS_LAZY_MOUNT
+/*!
+ * @brief Unmount volume: write its data to the device and free the file
+ *        system data. The volume is mounted again on the next access.
+ * @param vol_num Volume number
+ * @return 0 on success; -1 if there is no such volume, it has open files
+ *         or directory streams, or its data can't be written
+ */
+int8_t fs_umount(uint8_t vol_num) {
+    fs_volume_t *vol = vtable_get_vol(vol_num);
+    int8_t (*op)(fs_volume_t *);
+
+    if (!vol)
+        return -1;
+    if (!vol->fs_spec)
+        // not mounted
+        return 0;
+
+    if (vol->dir_open)
+        // EBUSY
+        return -1;
+    for (uint8_t fd = 0; fd < FS_OPEN_MAX; fd++) {
+        if (files[fd].vol == vol)
+            // EBUSY
+            return -1;
+    }
+
+    op = pgm_read_ptr(&vol->v_ops->syncfs);
+    if (op && op(vol))
+        return -1;
+    if (cache_flush(vol->bdev))
+        return -1;
+    // the medium may be changed after unmount
+    cache_invalidate(vol->bdev, vol->start_sector, vol->tot_sectors);
+
+    dcache_invalidate(vol);
+    if (pwd.vol == vol)
+        pwd.vol = NULL;
+
+    // FS specified data is a single allocation of the driver
+    free(vol->fs_spec);
+    vol->fs_spec = NULL;
+
+    return 0;
+}
+#endif  /* FS_LAZY_MOUNT */
+
+#if FS_STATS
+/*!
+ * @brief Get volume that holds the block of the device
+ * @return volume; NULL if the block is out of all volumes
+ */
+static fs_volume_t *vtable_get_vol_blk(const bdev_t *bdev, uint32_t block) {
+    fs_volume_t *vol;
+
+    for (vol = vol_tbl.next; vol; vol = vol->next) {
+        if ((vol->bdev == bdev) && (block >= vol->start_sector) &&
+            (block - vol->start_sector < vol->tot_sectors))
+            return vol;
+    }
+
+    return NULL;
+}
+
+/*!
+ * @brief Account completed request of the block device
+ * @param req Request
+ * @param ticks Duration of the request; FS_STATS_NO_TICKS if unknown
+ */
+void fs_stats_io(const req_t *req, uint32_t ticks) {
+    fs_volume_t *vol = vtable_get_vol_blk(req->bdev, req->block);
+    uint16_t cnt = req->blk_cnt ? req->blk_cnt : 1;
+    uint8_t bucket = 0;
+
+    if (!vol)
+        return;
+
+    if (req->cmd_flags == REQ_WRITE)
+        vol->stats.wr_sect += cnt;
+    else
+        vol->stats.rd_sect += cnt;
+
+    if (ticks == FS_STATS_NO_TICKS)
+        return;
+
+    // bucket is the number of significant bits
+    while (ticks && (bucket < FS_STATS_LAT_BUCKETS - 1)) {
+        ticks >>= 1;
+        bucket++;
+    }
+    if (vol->stats.lat[bucket] != 0xFFFF)
+        vol->stats.lat[bucket]++;
+}
+
+/*!
+ * @brief Account lookup of the sector cache
+ * @param bdev Block device
+ * @param block Block
+ * @param hit 1 if the block was in the cache
+ */
+void fs_stats_cache(const bdev_t *bdev, uint32_t block, uint8_t hit) {
+    fs_volume_t *vol = vtable_get_vol_blk(bdev, block);
+
+    if (!vol)
+        return;
+
+    if (hit)
+        vol->stats.cache_hit++;
+    else
+        vol->stats.cache_miss++;
+}
+
+/*!
+ * @brief Get copy of the volume statistics
+ * @param vol_num Volume number
+ * @param snap Destination
+ * @return 0 on success; -1 if there is no such volume
+ */
+int8_t fs_stats_get(uint8_t vol_num, fs_stats_t *snap) {
+    fs_volume_t *vol = vtable_get_vol(vol_num);
+
+    if (!vol)
+        return -1;
+
+    *snap = vol->stats;
+
+    return 0;
+}
+
+/*!
+ * @brief Clear the volume statistics
+ * @param vol_num Volume number
+ * @return 0 on success; -1 if there is no such volume
+ */
+int8_t fs_stats_reset(uint8_t vol_num) {
+    fs_volume_t *vol = vtable_get_vol(vol_num);
+
+    if (!vol)
+        return -1;
+
+    memset(&vol->stats, 0, sizeof(vol->stats));
+
+    return 0;
+}
+#endif  /* FS_STATS */
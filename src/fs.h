@@ -1,25 +1,60 @@
 #ifndef FS_H
 #define FS_H
 
+#include <avr/pgmspace.h>
+
 #include <stdint.h>
 #include <spi.h>
 
 #include "dirent.h"
 #include "block_dev.h"
+#include "cache.h"
+#include "fs_stats.h"
+
+/* Path component */
+typedef struct fs_name_s {
+    const char *name;   // first char of the component (not terminated)
+    uint8_t len;        // length of the component
+    uint8_t flags;      // FP_PGM if the name is in program memory
+    uint16_t hash;      // case insensitive hash of the component
+} fs_name_t;
+
+/* fs_follow_path() flags */
+#define FP_PGM 0x01     // path is in program memory
+
+struct stat;
+struct dirent;
+
+typedef struct fs_file_s file_t;
 
 struct vol_ops {
-    void (*create)(void);
-    void (*lookup)(void);
+    int8_t (*create)(DIR *dir, const fs_name_t *name);
+    int8_t (*lookup)(DIR *dir, const fs_name_t *name);
     void (*mkdir)(void);
     void (*rmdir)(void);
     void (*rename)(void);
     void (*setattr)(void);
-    void (*getattr)(void);
+    int8_t (*getattr)(DIR *dir, struct stat *st);
     void (*update_time)(void);
+    int8_t (*unlink)(DIR *dir);
+    int8_t (*readdir)(DIR *dir, struct dirent *ent);
+    void (*rewinddir)(DIR *dir);
+    int8_t (*open)(file_t *file, const DIR *dir, uint8_t oflag);
+    int16_t (*read)(file_t *file, void *buf, uint16_t count);
+    int16_t (*write)(file_t *file, const void *buf, uint16_t count);
+    int8_t (*lseek)(file_t *file, uint32_t pos);
+    int8_t (*fupdate)(file_t *file);
+    int8_t (*syncfs)(fs_volume_t *vol);
+    int8_t (*prealloc)(file_t *file, uint32_t size);
+    int8_t (*release)(file_t *file);
 };
 
 typedef struct fs_volume_s fs_volume_t;
 
+#ifndef FS_LAZY_MOUNT
+#define FS_LAZY_MOUNT 0 // 1 - read file system of a volume on first access
+#endif  /* !FS_LAZY_MOUNT */
+
 struct fs_volume_s {
     fs_volume_t *next;      // next volume in chain
     uint8_t v_num;          // volume number (0-127)
@@ -27,15 +62,92 @@ struct fs_volume_s {
     uint32_t tot_sectors;   // Total number of sectors
     uint8_t fs_type;        // File System type
     bdev_t *bdev;           // Block device
-    void *fs_spec;          // FS specified data
+    void *fs_spec;          // FS specified data; NULL if not mounted
     const struct vol_ops *v_ops;
     DIR root;               // root path
+#if FS_STATS
+    fs_stats_t stats;       // I/O statistics
+#endif  /* FS_STATS */
+#if FS_LAZY_MOUNT
+    uint8_t dir_open;       // number of open directory streams
+#endif  /* FS_LAZY_MOUNT */
 };
 
-int8_t get_root(DIR *restrict dir, const fs_volume_t *restrict vol);
+#ifndef FS_OPEN_MAX
+#define FS_OPEN_MAX 4   // size of the open file table
+#endif  /* !FS_OPEN_MAX */
+
+#ifndef FS_READAHEAD
+#define FS_READAHEAD 0  // sectors to prefetch on sequential read; 0 - off
+                        // (needs FS_CACHE_SLOTS > FS_READAHEAD + 1)
+#endif  /* !FS_READAHEAD */
+
+#if FS_READAHEAD && (FS_CACHE_SLOTS <= FS_READAHEAD + 1)
+#error "FS_READAHEAD needs FS_CACHE_SLOTS > FS_READAHEAD + 1"
+#endif
+
+#ifndef FS_FILE_EXTENTS
+#define FS_FILE_EXTENTS 0   // runs of the cluster chain every open file
+                            // keeps for seeking; 0 - off
+#endif  /* !FS_FILE_EXTENTS */
+
+/* Run of consecutive clusters of a chain */
+typedef struct fs_extent_s {
+    uint32_t clst;  // first cluster of the run
+    uint32_t fcl;   // index of that cluster in the chain; the run lasts
+                    // up to fcl of the next extent
+} fs_extent_t;
+
+/* Extent map (fast seek table) of a chain */
+typedef struct fs_extmap_s {
+    fs_extent_t *ext;   // table supplied by the caller
+    uint16_t size;      // table capacity in extents
+    uint16_t runs;      // extents in use
+    uint32_t clusters;  // number of clusters covered by the table
+    uint8_t complete;   // table covers the whole chain
+} fs_extmap_t;
+
+/* Open file */
+struct fs_file_s {
+    fs_volume_t *vol;   // volume; NULL if the handle is free
+    uint32_t fclust;    // first cluster; 0 - no data
+    uint32_t clust;     // cluster with the byte before pos; 0 - none yet
+    uint32_t pos;       // file position
+    uint32_t size;      // file size
+    uint32_t ent_sect;  // sector with the directory entry
+    uint8_t ent_idx;    // index of the entry in ent_sect
+    uint8_t flags;      // O_* flags of open() and F_*
+#define F_PREALLOC 0x40 // chain may have reserved clusters beyond the size
+#define F_DIRTY 0x80    // directory entry must be updated
+#if FS_READAHEAD
+    uint32_t last_sect; // last sector read through the cache
+#endif  /* FS_READAHEAD */
+#if FS_FILE_EXTENTS
+    fs_extmap_t map;    // runs of the chain; built on the first seek back
+    fs_extent_t ext[FS_FILE_EXTENTS];   // table of map
+#endif  /* FS_FILE_EXTENTS */
+};
+
+static inline char fs_path_char(const char *cp, uint8_t flags) {
+    return (flags & FP_PGM) ? pgm_read_byte(cp) : *cp;
+}
+
+static inline char fs_name_char(const fs_name_t *name, uint8_t idx) {
+    return fs_path_char(name->name + idx, name->flags);
+}
+
+int8_t get_root(DIR *restrict dir, fs_volume_t *restrict vol);
 void set_pwd(const char *path);
 void get_pwd(DIR *dir);
 
+int8_t fs_follow_path(DIR *restrict dir,
+                      const char *restrict path,
+                      uint8_t flags);
+
 int8_t volumes_determine(spi_dev_t *dev);
+#if FS_LAZY_MOUNT
+int8_t fs_umount(uint8_t vol_num);
+#endif  /* FS_LAZY_MOUNT */
+int8_t fs_prealloc(int8_t fd, uint32_t size);
 
 #endif  /* !FS_H */
@@ -0,0 +1,51 @@
+#ifndef FS_STATS_H
+#define FS_STATS_H
+
+#include <stdint.h>
+
+#include "block_dev.h"
+
+#ifndef FS_STATS
+#define FS_STATS 0              // per-volume I/O statistics; 0 - off
+#endif  /* !FS_STATS */
+
+#ifndef FS_STATS_LAT_BUCKETS
+#define FS_STATS_LAT_BUCKETS 16 // latency histogram buckets
+#endif  /* !FS_STATS_LAT_BUCKETS */
+
+#if FS_STATS
+
+typedef struct fs_stats_s {
+    uint32_t rd_sect;       // sectors read from the device
+    uint32_t wr_sect;       // sectors written to the device
+    uint32_t cache_hit;     // sector found in the cache
+    uint32_t cache_miss;    // sector loaded to the cache
+    uint32_t fat_load;      // FAT sectors fetched by the driver
+    uint32_t dir_scan;      // directory sectors scanned by lookups
+    uint32_t alloc;         // clusters allocated
+    // requests by latency: bucket 0 - 0 ticks, bucket n - from 2^(n-1)
+    // to 2^n - 1 ticks, the last one - all above; saturated at 0xFFFF
+    uint16_t lat[FS_STATS_LAT_BUCKETS];
+} fs_stats_t;
+
+typedef uint32_t (*fs_ticks_f)(void);
+
+#define FS_STATS_NO_TICKS 0xFFFFFFFF    // latency is not measured
+
+#define FS_STAT_ADD(vol, field, n) ((vol)->stats.field += (n))
+
+void fs_stats_clock(fs_ticks_f ticks);
+int8_t fs_stats_get(uint8_t vol_num, fs_stats_t *snap);
+int8_t fs_stats_reset(uint8_t vol_num);
+
+/* hooks of the lower layers */
+void fs_stats_io(const req_t *req, uint32_t ticks);
+void fs_stats_cache(const bdev_t *bdev, uint32_t block, uint8_t hit);
+
+#else
+
+#define FS_STAT_ADD(vol, field, n) ((void)0)
+
+#endif  /* FS_STATS */
+
+#endif  /* !FS_STATS_H */
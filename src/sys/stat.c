@@ -1,3 +1,5 @@
+#include <avr/pgmspace.h>
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,10 +9,6 @@
 #include "stat.h"
 #include "dirent.h"
 
-extern int8_t fs_follow_path(DIR *restrict dir,
-                             const char *restrict path,
-                             uint8_t flags);
-
 /*!
  * @brief Get file attributes by name
  * @param dir A base dir for a relative filename
@@ -22,19 +20,21 @@ extern int8_t fs_follow_path(DIR *restrict dir,
 static int8_t __stat_at(DIR *restrict dir, int flags,
                         const char *restrict path,
                         struct stat *restrict stat) {
-    int8_t err;
+    int8_t (*getattr)(DIR *, struct stat *);
+    DIR base = {0};
+
+    if (!dir)
+        dir = &base;
 
-    if (!dir) {
-        dir = malloc(sizeof(*dir));
-        if (dir)
-            // ENOMEM
-            return -1;
-        memset(dir, 0, sizeof(*dir));
-    }
+    if (fs_follow_path(dir, path, flags))
+        return -1;
 
-    err = fs_follow_path(dir, path, flags);
+    getattr = pgm_read_ptr(&dir->vol->v_ops->getattr);
+    if (!getattr)
+        // ENOSYS
+        return -1;
 
-    return -1;
+    return getattr(dir, stat);
 }
 
 /*!
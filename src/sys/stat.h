@@ -5,9 +5,9 @@
 #include <sys/types.h>
 #include <time.h>
 
-#ifndef mod_t
+#ifndef mode_t
 typedef uint32_t mode_t;
-#endif  /* mod_t */
+#endif  /* mode_t */
 
 #ifndef nlink_t
 typedef uint16_t nlink_t;
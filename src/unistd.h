@@ -0,0 +1,21 @@
+#ifndef UNISTD_H
+#define UNISTD_H
+
+#include <stdint.h>
+
+/* lseek() whence */
+#ifndef SEEK_SET
+#define SEEK_SET    0   // set position to offset
+#define SEEK_CUR    1   // set position to current position plus offset
+#define SEEK_END    2   // set position to end of file plus offset
+#endif  /* !SEEK_SET */
+
+int8_t close(int8_t fd);
+int8_t fsync(int8_t fd);
+int32_t lseek(int8_t fd, int32_t offset, uint8_t whence);
+int16_t read(int8_t fd, void *buf, uint16_t count);
+void sync(void);
+int8_t unlink(const char *path);
+int16_t write(int8_t fd, const void *buf, uint16_t count);
+
+#endif  /* !UNISTD_H */